@@ -7,6 +7,8 @@
 #include "telegram-bot-api/Client.h"
 
 #include "telegram-bot-api/ClientParameters.h"
+#include "telegram-bot-api/HttpConnection.h"
+#include "telegram-bot-api/UpdateStorage.h"
 
 #include "td/db/TQueue.h"
 
@@ -48,8 +50,7 @@ Client::Client(td::ActorShared<> parent, const td::string &bot_token, bool is_te
     , tqueue_id_(tqueue_id)
     , parameters_(std::move(parameters))
     , stat_actor_(std::move(stat_actor)) {
-  static auto is_inited = init_methods();
-  CHECK(is_inited);
+  init_methods_once();
 }
 
 Client::~Client() {
@@ -213,6 +214,20 @@ bool Client::is_special_error_code(int32 error_code) {
   return error_code == 401 || error_code == 429 || error_code >= 500;
 }
 
+void Client::init_methods_once() {
+  static auto is_inited = init_methods();
+  CHECK(is_inited);
+}
+
+td::Slice Client::get_stat_method_name(td::Slice method) {
+  init_methods_once();
+  auto it = methods_.find(method.str());
+  if (it == methods_.end()) {
+    return td::Slice("<other>");
+  }
+  return it->first;
+}
+
 bool Client::init_methods() {
   methods_.emplace("getme", &Client::process_get_me_query);
   methods_.emplace("getmycommands", &Client::process_get_my_commands_query);
@@ -389,6 +404,8 @@ bool Client::init_methods() {
   methods_.emplace("sendcustomrequest", &Client::process_send_custom_request_query);
   methods_.emplace("answercustomquery", &Client::process_answer_custom_query_query);
   methods_.emplace("getupdates", &Client::process_get_updates_query);
+  methods_.emplace("streamupdates", &Client::process_stream_updates_query);
+  methods_.emplace("ackupdates", &Client::process_ack_updates_query);
   methods_.emplace("setwebhook", &Client::process_set_webhook_query);
   methods_.emplace("deletewebhook", &Client::process_set_webhook_query);
   methods_.emplace("getwebhookinfo", &Client::process_get_webhook_info_query);
@@ -5968,6 +5985,9 @@ class Client::JsonWebhookInfo final : public td::Jsonable {
     if (client_->webhook_max_connections_ > 0) {
       object("max_connections", client_->webhook_max_connections_);
     }
+    if (client_->webhook_batch_size_ > 1) {
+      object("batch_size", client_->webhook_batch_size_);
+    }
     if (!url.empty()) {
       object("ip_address", client_->webhook_ip_address_.empty() ? "<unknown>" : client_->webhook_ip_address_);
     }
@@ -7892,10 +7912,30 @@ ServerBotInfo Client::get_bot_info() const {
   res.tail_update_id_ = tqueue->get_tail(tqueue_id_).value();
   res.webhook_max_connections_ = webhook_max_connections_;
   res.pending_update_count_ = tqueue->get_size(tqueue_id_);
+  if (!webhook_id_.empty()) {
+    auto *webhook_actor = webhook_id_.get_actor_unsafe();
+    res.webhook_connection_count_ = webhook_actor->get_connection_count();
+    res.webhook_active_request_count_ = webhook_actor->get_active_request_count();
+  }
+  if (last_webhook_error_date_ > 0) {
+    res.last_webhook_error_date_ = last_webhook_error_date_;
+    res.last_webhook_error_message_ = last_webhook_error_.message().str();
+  }
   res.start_time_ = start_time_;
   return res;
 }
 
+td::vector<StatItem> Client::get_latency_stats() const {
+  td::vector<StatItem> res;
+  if (!webhook_url_.empty() && webhook_latency_stats_ != nullptr) {
+    res = webhook_latency_stats_->as_vector();
+  }
+  if (get_updates_batch_size_.get_count() != 0) {
+    res.push_back({"get_updates_batch_size", get_updates_batch_size_.get_percentiles()});
+  }
+  return res;
+}
+
 void Client::start_up() {
   CHECK(start_time_ < 1e-10);
   start_time_ = td::Time::now();
@@ -9270,6 +9310,7 @@ void Client::on_closed() {
     long_poll_wakeup(true);
     CHECK(!long_poll_query_);
   }
+  close_update_stream();
 
   while (!cmd_queue_.empty()) {
     auto query = std::move(cmd_queue_.front());
@@ -12663,6 +12704,7 @@ void Client::on_cmd(PromisedQueryPtr query, bool force) {
   if (method_it == methods_.end()) {
     return fail_query(404, "Not Found: method not found", std::move(query));
   }
+  query->set_stat_method_name(method_it->first);
 
   if (!query->files().empty() && !parameters_->local_mode_ && !force) {
     auto file_size = query->files_size();
@@ -15705,10 +15747,20 @@ td::Status Client::process_get_updates_query(PromisedQueryPtr &query) {
     return td::Status::OK();
   }
   int32 offset = get_integer_arg(query.get(), "offset", 0);
-  int32 limit = get_integer_arg(query.get(), "limit", 100, 1, 100);
+  int32 limit = get_integer_arg(query.get(), "limit", MAX_GET_UPDATES_LIMIT, 1, MAX_GET_UPDATES_LIMIT);
   int32 timeout = get_integer_arg(query.get(), "timeout", 0, 0, LONG_POLL_MAX_TIMEOUT);
 
-  update_allowed_update_types(query.get());
+  // by default, updates received during long polling are returned after a short delay to be returned together;
+  // the delay can be increased to receive bigger batches, or decreased to 0 to receive updates as soon as possible
+  LongPollCoalescingPolicy policy;
+  if (query->has_arg("coalescing_delay")) {
+    policy.max_delay_ = get_integer_arg(query.get(), "coalescing_delay", 0, 0, LONG_POLL_MAX_COALESCING_DELAY) * 0.001;
+  }
+  policy.min_update_count_ = get_integer_arg(query.get(), "coalescing_min_update_count", 0, 0, limit);
+  policy.min_update_size_ = static_cast<std::size_t>(
+      get_integer_arg(query.get(), "coalescing_min_update_size", 0, 0, LONG_POLL_MAX_COALESCING_UPDATE_SIZE));
+
+  update_allowed_update_types(get_allowed_update_types(query->arg("allowed_updates"), query->is_internal()));
 
   auto now = td::Time::now_cached();
   if (offset == previous_get_updates_offset_ && timeout < 3 && now < previous_get_updates_start_time_ + 3.0) {
@@ -15719,15 +15771,79 @@ td::Status Client::process_get_updates_query(PromisedQueryPtr &query) {
   }
   previous_get_updates_offset_ = offset;
   previous_get_updates_start_time_ = now;
-  do_get_updates(offset, limit, timeout, std::move(query));
+  close_update_stream();
+  do_get_updates(offset, limit, timeout, policy, std::move(query));
+  return td::Status::OK();
+}
+
+td::Status Client::process_stream_updates_query(PromisedQueryPtr &query) {
+  if (!webhook_url_.empty() || webhook_set_query_ || active_webhook_set_query_) {
+    fail_query_conflict(
+        "Conflict: can't use streamUpdates method while webhook is active; use deleteWebhook to delete the webhook "
+        "first",
+        std::move(query));
+    return td::Status::OK();
+  }
+  if (query->http_connection_id().empty()) {
+    return td::Status::Error(400, "Bad Request: updates can't be streamed in response to the request");
+  }
+  int32 offset = get_integer_arg(query.get(), "offset", 0);
+  int32 limit = get_integer_arg(query.get(), "limit", UPDATE_STREAM_DEFAULT_MAX_UNACKNOWLEDGED_UPDATES, 1,
+                                UPDATE_STREAM_MAX_UNACKNOWLEDGED_UPDATES);
+
+  update_allowed_update_types(get_allowed_update_types(query->arg("allowed_updates"), query->is_internal()));
+
+  abort_long_poll(false);
+  close_update_stream();
+  forget_updates(offset);
+
+  update_stream_generation_++;
+  update_stream_connection_id_ = query->http_connection_id();
+  update_stream_max_unacknowledged_updates_ = limit;
+  update_stream_offset_ = td::TQueue::EventId();
+  update_stream_chunks_ = {};
+  update_stream_unacknowledged_size_ = 0;
+  send_closure(update_stream_connection_id_, &HttpConnection::set_stream_close_promise,
+               td::PromiseCreator::lambda(
+                   [actor_id = actor_id(this), generation = update_stream_generation_](td::Result<td::Unit> result) {
+                     send_closure(actor_id, &Client::on_update_stream_closed, generation);
+                   }));
+  query->set_stream();
+  query.reset();  // start the stream before sending updates
+
+  schedule_update_stream_flush();
+  return td::Status::OK();
+}
+
+td::Status Client::process_ack_updates_query(PromisedQueryPtr &query) {
+  if (!webhook_url_.empty() || webhook_set_query_ || active_webhook_set_query_) {
+    fail_query_conflict(
+        "Conflict: can't use ackUpdates method while webhook is active; use deleteWebhook to delete the webhook first",
+        std::move(query));
+    return td::Status::OK();
+  }
+  if (update_stream_connection_id_.empty()) {
+    fail_query_conflict("Conflict: there is no active update stream; use streamUpdates to start it", std::move(query));
+    return td::Status::OK();
+  }
+  int32 offset = get_integer_arg(query.get(), "offset", 0);
+  if (offset <= 0) {
+    return td::Status::Error(400, "Bad Request: offset must be positive");
+  }
+  forget_updates(offset);
+  schedule_update_stream_flush();
+  answer_query(td::JsonTrue(), std::move(query));
   return td::Status::OK();
 }
 
 td::Status Client::process_set_webhook_query(PromisedQueryPtr &query) {
-  td::Slice new_url;
-  if (query->method() == "setwebhook") {
-    new_url = query->arg("url");
+  auto r_new_webhook = get_webhook_config(query.get());
+  if (r_new_webhook.is_error()) {
+    LOG(ERROR) << "Failed to get webhook parameters: " << r_new_webhook.error();
+    return td::Status::Error(500, "Internal Server Error: failed to restore webhook");
   }
+  auto new_webhook = r_new_webhook.move_as_ok();
+  td::Slice new_url = new_webhook.url_;
 
   auto now = td::Time::now_cached();
   if (!new_url.empty() && !query->is_internal()) {
@@ -15741,13 +15857,12 @@ td::Status Client::process_set_webhook_query(PromisedQueryPtr &query) {
   // do not send warning just after webhook was deleted or set
   next_bot_updates_warning_time_ = td::max(next_bot_updates_warning_time_, now + BOT_UPDATES_WARNING_DELAY);
 
-  bool new_has_certificate = new_url.empty() ? false
-                                             : (get_webhook_certificate(query.get()) != nullptr ||
-                                                (query->is_internal() && query->arg("certificate") == "previous"));
-  int32 new_max_connections = new_url.empty() ? 0 : get_webhook_max_connections(query.get());
-  td::Slice new_ip_address = new_url.empty() ? td::Slice() : query->arg("ip_address");
-  bool new_fix_ip_address = new_url.empty() ? false : get_webhook_fix_ip_address(query.get());
-  td::Slice new_secret_token = new_url.empty() ? td::Slice() : query->arg("secret_token");
+  bool new_has_certificate = new_webhook.has_certificate_;
+  int32 new_max_connections = new_webhook.max_connections_;
+  int32 new_batch_size = new_url.empty() ? 0 : new_webhook.batch_size_;
+  td::Slice new_ip_address = new_webhook.ip_address_;
+  bool new_fix_ip_address = new_webhook.fix_ip_address_;
+  td::Slice new_secret_token = new_webhook.secret_token_;
   bool drop_pending_updates = to_bool(query->arg("drop_pending_updates"));
   if (webhook_set_query_) {
     // already updating webhook. Cancel previous request
@@ -15756,10 +15871,10 @@ td::Status Client::process_set_webhook_query(PromisedQueryPtr &query) {
     query->set_retry_after_error(1);
     return td::Status::OK();
   } else if (webhook_url_ == new_url && !has_webhook_certificate_ && !new_has_certificate &&
-             new_max_connections == webhook_max_connections_ && new_fix_ip_address == webhook_fix_ip_address_ &&
-             new_secret_token == webhook_secret_token_ &&
+             new_max_connections == webhook_max_connections_ && new_batch_size == webhook_batch_size_ &&
+             new_fix_ip_address == webhook_fix_ip_address_ && new_secret_token == webhook_secret_token_ &&
              (!new_fix_ip_address || new_ip_address == webhook_ip_address_) && !drop_pending_updates) {
-    if (update_allowed_update_types(query.get())) {
+    if (update_allowed_update_types(new_webhook.allowed_update_types_)) {
       save_webhook();
     } else if (now > next_webhook_is_not_modified_warning_time_) {
       next_webhook_is_not_modified_warning_time_ = now + 300;
@@ -15778,7 +15893,9 @@ td::Status Client::process_set_webhook_query(PromisedQueryPtr &query) {
 
   if (!new_url.empty()) {
     abort_long_poll(true);
+    close_update_stream();
   }
+  pending_webhook_config_ = std::move(new_webhook);
 
   webhook_generation_++;
   // need to close old webhook first
@@ -15882,26 +15999,19 @@ void Client::webhook_verified(td::string cached_ip_address) {
 }
 
 void Client::save_webhook() const {
-  td::string value;
-  if (has_webhook_certificate_) {
-    value += "cert/";
-  }
-  value += PSTRING() << "#maxc" << webhook_max_connections_ << '/';
-  if (!webhook_ip_address_.empty()) {
-    value += PSTRING() << "#ip" << webhook_ip_address_ << '/';
-  }
-  if (webhook_fix_ip_address_) {
-    value += "#fix_ip/";
-  }
-  if (!webhook_secret_token_.empty()) {
-    value += PSTRING() << "#secret" << webhook_secret_token_ << '/';
-  }
+  WebhookConfig config;
+  config.url_ = webhook_url_;
+  config.max_connections_ = webhook_max_connections_;
+  config.batch_size_ = webhook_batch_size_;
+  config.ip_address_ = webhook_ip_address_;
+  config.fix_ip_address_ = webhook_fix_ip_address_;
+  config.secret_token_ = webhook_secret_token_;
   if (allowed_update_types_ != DEFAULT_ALLOWED_UPDATE_TYPES) {
-    value += PSTRING() << "#allow" << allowed_update_types_ << '/';
+    config.allowed_update_types_ = allowed_update_types_;
   }
-  value += webhook_url_;
-  LOG(INFO) << "Save webhook " << value;
-  parameters_->shared_data_->webhook_db_->set(bot_token_with_dc_, value);
+  config.has_certificate_ = has_webhook_certificate_;
+  LOG(INFO) << "Save webhook " << webhook_url_;
+  parameters_->shared_data_->webhook_db_->set(bot_token_with_dc_, serialize_webhook_config(config));
 }
 
 void Client::webhook_success() {
@@ -15948,6 +16058,7 @@ void Client::on_webhook_closed(td::Status status) {
   webhook_url_ = td::string();
   has_webhook_certificate_ = false;
   webhook_max_connections_ = 0;
+  webhook_batch_size_ = 0;
   webhook_ip_address_ = td::string();
   webhook_fix_ip_address_ = false;
   webhook_secret_token_ = td::string();
@@ -15991,11 +16102,33 @@ td::int32 Client::get_webhook_max_connections(const Query *query) const {
   return get_integer_arg(query, "max_connections", default_value, 1, max_value);
 }
 
-bool Client::get_webhook_fix_ip_address(const Query *query) {
+td::Result<WebhookConfig> Client::get_webhook_config(const Query *query) const {
   if (query->is_internal()) {
-    return query->has_arg("fix_ip_address");
+    // the webhook is restored from webhooks_db
+    TRY_RESULT(config, parse_webhook_config(query->arg("webhook_config")));
+    auto max_value = parameters_->local_mode_ ? 100000 : 100;
+    if (config.max_connections_ <= 0) {
+      config.max_connections_ = parameters_->default_max_webhook_connections_;
+    } else if (config.max_connections_ > max_value) {
+      config.max_connections_ = max_value;
+    }
+    config.batch_size_ = td::clamp(config.batch_size_, 1, MAX_WEBHOOK_BATCH_SIZE);
+    return std::move(config);
   }
-  return !query->arg("ip_address").empty();
+
+  WebhookConfig config;
+  config.allowed_update_types_ = get_allowed_update_types(query->arg("allowed_updates"), false);
+  if (query->method() != "setwebhook" || query->arg("url").empty()) {
+    return std::move(config);
+  }
+  config.url_ = query->arg("url").str();
+  config.max_connections_ = get_webhook_max_connections(query);
+  config.batch_size_ = get_integer_arg(query, "batch_size", 1, 1, MAX_WEBHOOK_BATCH_SIZE);
+  config.ip_address_ = query->arg("ip_address").str();
+  config.fix_ip_address_ = !config.ip_address_.empty();
+  config.secret_token_ = query->arg("secret_token").str();
+  config.has_certificate_ = get_webhook_certificate(query) != nullptr;
+  return std::move(config);
 }
 
 void Client::do_set_webhook(PromisedQueryPtr query, bool was_deleted) {
@@ -16006,16 +16139,14 @@ void Client::do_set_webhook(PromisedQueryPtr query, bool was_deleted) {
   if (to_bool(query->arg("drop_pending_updates"))) {
     clear_tqueue();
   }
-  td::Slice new_url;
-  if (query->method() == "setwebhook") {
-    new_url = query->arg("url");
-  }
+  const auto &new_webhook = pending_webhook_config_;
+  td::Slice new_url = new_webhook.url_;
   if (!new_url.empty()) {
     auto url = td::parse_url(new_url, td::HttpUrl::Protocol::Https);
     if (url.is_error()) {
       return fail_query(400, "Bad Request: invalid webhook URL specified", std::move(query));
     }
-    auto secret_token = query->arg("secret_token");
+    td::Slice secret_token = new_webhook.secret_token_;
     if (secret_token.size() > 256) {
       return fail_query(400, "Bad Request: secret token is too long", std::move(query));
     }
@@ -16030,7 +16161,7 @@ void Client::do_set_webhook(PromisedQueryPtr query, bool was_deleted) {
 
     CHECK(!has_webhook_certificate_);
     if (query->is_internal()) {
-      has_webhook_certificate_ = query->arg("certificate") == "previous";
+      has_webhook_certificate_ = new_webhook.has_certificate_;
     } else {
       auto *cert_file_ptr = get_webhook_certificate(query.get());
       if (cert_file_ptr != nullptr) {
@@ -16075,28 +16206,33 @@ void Client::finish_set_webhook(PromisedQueryPtr query) {
   if (logging_out_ || closing_) {
     return fail_query_closing(std::move(query));
   }
-  td::Slice new_url = query->arg("url");
-  CHECK(!new_url.empty());
-  webhook_url_ = new_url.str();
+  auto new_webhook = std::move(pending_webhook_config_);
+  pending_webhook_config_ = WebhookConfig();
+  CHECK(!new_webhook.url_.empty());
+  webhook_url_ = std::move(new_webhook.url_);
   webhook_set_time_ = td::Time::now();
-  webhook_max_connections_ = get_webhook_max_connections(query.get());
-  webhook_secret_token_ = query->arg("secret_token").str();
-  webhook_ip_address_ = query->arg("ip_address").str();
-  webhook_fix_ip_address_ = get_webhook_fix_ip_address(query.get());
+  webhook_max_connections_ = new_webhook.max_connections_;
+  webhook_batch_size_ = new_webhook.batch_size_;
+  webhook_secret_token_ = std::move(new_webhook.secret_token_);
+  webhook_ip_address_ = std::move(new_webhook.ip_address_);
+  webhook_fix_ip_address_ = new_webhook.fix_ip_address_;
   last_webhook_error_date_ = 0;
   last_webhook_error_ = td::Status::OK();
 
-  update_allowed_update_types(query.get());
+  update_allowed_update_types(new_webhook.allowed_update_types_);
 
+  td::Slice new_url = webhook_url_;
   auto url = td::parse_url(new_url, td::HttpUrl::Protocol::Https);
   CHECK(url.is_ok());
 
   LOG(WARNING) << "Create " << (has_webhook_certificate_ ? "self-signed " : "") << "webhook: " << new_url;
   auto webhook_actor_name = PSTRING() << "Webhook " << url.ok();
+  webhook_latency_stats_ = std::make_shared<WebhookLatencyStats>();
   webhook_id_ = td::create_actor<WebhookActor>(
       webhook_actor_name, actor_shared(this, webhook_generation_), tqueue_id_, url.move_as_ok(),
       has_webhook_certificate_ ? get_webhook_certificate_path() : td::string(), webhook_max_connections_,
-      query->is_internal(), webhook_ip_address_, webhook_fix_ip_address_, webhook_secret_token_, parameters_);
+      webhook_batch_size_, query->is_internal(), webhook_ip_address_, webhook_fix_ip_address_, webhook_secret_token_,
+      webhook_latency_stats_, parameters_);
   // wait for webhook verified or webhook callback
   webhook_query_type_ = WebhookQueryType::Verify;
   CHECK(!active_webhook_set_query_);
@@ -16318,7 +16454,15 @@ class Client::JsonUpdates final : public td::Jsonable {
   td::Span<td::TQueue::Event> updates_;
 };
 
-void Client::do_get_updates(int32 offset, int32 limit, int32 timeout, PromisedQueryPtr query) {
+// all clients are handled on the same scheduler, so the statistics don't need synchronization
+static Histogram global_get_updates_batch_size(Client::MAX_GET_UPDATES_LIMIT);
+
+const Histogram &Client::get_global_get_updates_batch_size() {
+  return global_get_updates_batch_size;
+}
+
+void Client::do_get_updates(int32 offset, int32 limit, int32 timeout, const LongPollCoalescingPolicy &policy,
+                            PromisedQueryPtr query) {
   auto &tqueue = parameters_->shared_data_->tqueue_;
   LOG(DEBUG) << "Get updates with offset = " << offset << ", limit = " << limit << " and timeout = " << timeout;
   LOG(DEBUG) << "Queue head = " << tqueue->get_head(tqueue_id_) << ", queue tail = " << tqueue->get_tail(tqueue_id_);
@@ -16331,21 +16475,19 @@ void Client::do_get_updates(int32 offset, int32 limit, int32 timeout, PromisedQu
     offset = tqueue->get_head(tqueue_id_).value();
   }
 
-  td::MutableSpan<td::TQueue::Event> updates(parameters_->shared_data_->event_buffer_,
-                                             SharedData::TQUEUE_EVENT_BUFFER_SIZE);
-  updates.truncate(limit);
+  TQueueEventBuffer event_buffer(static_cast<size_t>(limit));
   td::TQueue::EventId from;
   size_t total_size = 0;
   if (offset <= 0) {
     // queue is not created yet
-    updates = {};
+    event_buffer.clear();
   } else {
     bool is_ok = false;
     auto r_offset = td::TQueue::EventId::from_int32(offset);
     auto now = get_unix_time();
     if (r_offset.is_ok()) {
       from = r_offset.ok();
-      auto r_total_size = tqueue->get(tqueue_id_, from, true, now, updates);
+      auto r_total_size = event_buffer.get(*tqueue, tqueue_id_, from, true, now);
       if (r_total_size.is_ok()) {
         is_ok = true;
         total_size = r_total_size.move_as_ok();
@@ -16353,11 +16495,12 @@ void Client::do_get_updates(int32 offset, int32 limit, int32 timeout, PromisedQu
     }
     if (!is_ok) {
       from = tqueue->get_head(tqueue_id_);
-      auto r_total_size = tqueue->get(tqueue_id_, from, true, now, updates);
+      auto r_total_size = event_buffer.get(*tqueue, tqueue_id_, from, true, now);
       CHECK(r_total_size.is_ok());
       total_size = r_total_size.move_as_ok();
     }
   }
+  auto &updates = event_buffer.events();
   CHECK(total_size >= updates.size());
   total_size -= updates.size();
 
@@ -16387,6 +16530,9 @@ void Client::do_get_updates(int32 offset, int32 limit, int32 timeout, PromisedQu
     abort_long_poll(false);
     long_poll_offset_ = offset;
     long_poll_limit_ = limit;
+    long_poll_policy_ = policy;
+    long_poll_update_count_ = 0;
+    long_poll_update_size_ = 0;
     long_poll_query_ = std::move(query);
     long_poll_was_wakeup_ = false;
     long_poll_hard_timeout_ = td::Time::now_cached() + timeout;
@@ -16400,6 +16546,8 @@ void Client::do_get_updates(int32 offset, int32 limit, int32 timeout, PromisedQu
     send_request(make_object<td_api::setBotUpdatesStatus>(0, ""), td::make_unique<TdOnOkCallback>());
     was_bot_updates_warning_ = false;
   }
+  get_updates_batch_size_.add(updates.size());
+  global_get_updates_batch_size.add(updates.size());
   answer_query(JsonUpdates(updates), std::move(query));
 }
 
@@ -16417,19 +16565,140 @@ void Client::long_poll_wakeup(bool force_flag) {
     return;
   }
   if (force_flag) {
-    do_get_updates(long_poll_offset_, long_poll_limit_, 0, std::move(long_poll_query_));
+    do_get_updates(long_poll_offset_, long_poll_limit_, 0, long_poll_policy_, std::move(long_poll_query_));
   } else {
     double now = td::Time::now();
     if (!long_poll_was_wakeup_) {
-      long_poll_hard_timeout_ = td::min(now + LONG_POLL_MAX_DELAY, long_poll_hard_timeout_);
+      long_poll_hard_timeout_ = td::min(now + long_poll_policy_.max_delay_, long_poll_hard_timeout_);
       long_poll_was_wakeup_ = true;
     }
-    double timeout = td::min(now + LONG_POLL_WAIT_AFTER, long_poll_hard_timeout_);
+    double timeout = long_poll_hard_timeout_;
+    if (long_poll_policy_.min_update_count_ == 0 && long_poll_policy_.min_update_size_ == 0) {
+      // wait for more updates while they continue to arrive
+      timeout = td::min(now + LONG_POLL_WAIT_AFTER, timeout);
+    } else if ((long_poll_policy_.min_update_count_ != 0 &&
+                long_poll_update_count_ >= long_poll_policy_.min_update_count_) ||
+               (long_poll_policy_.min_update_size_ != 0 &&
+                long_poll_update_size_ >= long_poll_policy_.min_update_size_)) {
+      return do_get_updates(long_poll_offset_, long_poll_limit_, 0, long_poll_policy_, std::move(long_poll_query_));
+    }
     long_poll_slot_.set_event(td::EventCreator::raw(actor_id(), static_cast<td::uint64>(0)));
     long_poll_slot_.set_timeout_at(timeout);
   }
 }
 
+void Client::forget_updates(int32 offset) {
+  auto r_offset = td::TQueue::EventId::from_int32(offset);
+  if (offset <= 0 || r_offset.is_error()) {
+    return;
+  }
+
+  // all updates before the offset are forgotten while getting updates after it
+  TQueueEventBuffer event_buffer(1);
+  auto r_size = event_buffer.get(*parameters_->shared_data_->tqueue_, tqueue_id_, r_offset.ok(), true, get_unix_time());
+  if (r_size.is_error()) {
+    LOG(DEBUG) << "Failed to forget updates before " << offset << ": " << r_size.error();
+  }
+}
+
+void Client::schedule_update_stream_flush() {
+  if (update_stream_connection_id_.empty() || is_update_stream_flush_scheduled_) {
+    return;
+  }
+  is_update_stream_flush_scheduled_ = true;
+  send_closure_later(actor_id(this), &Client::flush_update_stream);
+}
+
+void Client::flush_update_stream() {
+  is_update_stream_flush_scheduled_ = false;
+  if (update_stream_connection_id_.empty()) {
+    return;
+  }
+
+  auto &tqueue = parameters_->shared_data_->tqueue_;
+  auto head = tqueue->get_head(tqueue_id_);
+  if (head.empty()) {
+    // queue is not created yet
+    return;
+  }
+  if (update_stream_offset_.empty() || update_stream_offset_.value() < head.value()) {
+    update_stream_offset_ = head;
+  }
+  while (!update_stream_chunks_.empty() && update_stream_chunks_.front().first.value() <= head.value()) {
+    CHECK(update_stream_unacknowledged_size_ >= update_stream_chunks_.front().second);
+    update_stream_unacknowledged_size_ -= update_stream_chunks_.front().second;
+    update_stream_chunks_.pop();
+  }
+  auto unacknowledged_update_count = update_stream_offset_.value() - head.value();
+  if (unacknowledged_update_count >= update_stream_max_unacknowledged_updates_ ||
+      update_stream_unacknowledged_size_ >= UPDATE_STREAM_MAX_UNACKNOWLEDGED_SIZE) {
+    LOG(DEBUG) << "Wait for acknowledgement of " << unacknowledged_update_count << " streamed updates of size "
+               << update_stream_unacknowledged_size_;
+    return;
+  }
+  auto limit = td::min(TQueueEventBuffer::MAX_EVENT_COUNT,
+                       static_cast<size_t>(update_stream_max_unacknowledged_updates_ - unacknowledged_update_count));
+
+  TQueueEventBuffer event_buffer(limit);
+  auto r_size = event_buffer.get(*tqueue, tqueue_id_, update_stream_offset_, false, get_unix_time());
+  if (r_size.is_error()) {
+    LOG(ERROR) << "Failed to get updates from " << update_stream_offset_ << ": " << r_size.error();
+    update_stream_offset_ = td::TQueue::EventId();
+    return;
+  }
+  auto &updates = event_buffer.events();
+
+  // the body is sent in chunks of limited size as soon as they are built
+  td::string data;
+  size_t sent_update_count = 0;
+  for (auto &update : updates) {
+    auto update_json = td::json_encode<td::string>(JsonUpdate(update.id.value(), update.data, true));
+    // JSON strings can't contain unescaped line feeds, so each update takes exactly one line
+    DCHECK(update_json.find('\n') == td::string::npos);
+    data += update_json;
+    data += '\n';
+    sent_update_count++;
+    update_stream_offset_ = update.id.next().move_as_ok();
+    if (data.size() >= UPDATE_STREAM_MAX_CHUNK_SIZE || sent_update_count == updates.size()) {
+      update_stream_chunks_.push({update_stream_offset_, data.size()});
+      update_stream_unacknowledged_size_ += data.size();
+      send_closure(update_stream_connection_id_, &HttpConnection::send_stream_data, td::BufferSlice(data));
+      data.clear();
+      if (update_stream_unacknowledged_size_ >= UPDATE_STREAM_MAX_UNACKNOWLEDGED_SIZE) {
+        break;
+      }
+    }
+  }
+  LOG(DEBUG) << "Stream " << sent_update_count << " updates";
+
+  if (sent_update_count == updates.size() && !event_buffer.get_next_event_id().empty()) {
+    // skip also the events, which failed to be unpacked
+    update_stream_offset_ = event_buffer.get_next_event_id();
+    if (event_buffer.get_received_event_count() == limit) {
+      // there can be more updates to send
+      schedule_update_stream_flush();
+    }
+  }
+}
+
+void Client::close_update_stream() {
+  if (update_stream_connection_id_.empty()) {
+    return;
+  }
+  send_closure(update_stream_connection_id_, &HttpConnection::finish_stream);
+  update_stream_connection_id_ = td::ActorId<HttpConnection>();
+  update_stream_generation_++;
+}
+
+void Client::on_update_stream_closed(int64 generation) {
+  if (generation != update_stream_generation_) {
+    return;
+  }
+  LOG(INFO) << "Update stream was closed";
+  update_stream_connection_id_ = td::ActorId<HttpConnection>();
+  update_stream_generation_++;
+}
+
 void Client::add_user(UserInfo *user_info, object_ptr<td_api::user> &&user) {
   user_info->first_name = std::move(user->first_name_);
   user_info->last_name = std::move(user->last_name_);
@@ -16928,8 +17197,7 @@ td::uint32 Client::get_allowed_update_types(td::MutableSlice allowed_updates, bo
   return result;
 }
 
-bool Client::update_allowed_update_types(const Query *query) {
-  auto allowed_update_types = get_allowed_update_types(query->arg("allowed_updates"), query->is_internal());
+bool Client::update_allowed_update_types(td::uint32 allowed_update_types) {
   if (allowed_update_types != 0 && allowed_update_types != allowed_update_types_) {
     allowed_update_types_ = allowed_update_types;
     object_ptr<td_api::OptionValue> value;
@@ -16974,7 +17242,7 @@ void Client::add_update_impl(UpdateType update_type, const td::VirtuallyJsonable
     return;
   }
 
-  send_closure(stat_actor_, &BotStatActor::add_event<ServerBotStat::Update>, ServerBotStat::Update{}, td::Time::now());
+  stat_actor_.get_actor_unsafe()->add_event(ServerBotStat::Update{}, td::Time::now());
 
   const size_t BUF_SIZE = 1 << 16;
   auto buf = td::StackAllocator::alloc(BUF_SIZE);
@@ -16988,12 +17256,19 @@ void Client::add_update_impl(UpdateType update_type, const td::VirtuallyJsonable
   }
 
   auto update_slice = jb.string_builder().as_cslice();
-  auto r_id = parameters_->shared_data_->tqueue_->push(tqueue_id_, update_slice.str(), get_unix_time() + timeout,
-                                                       webhook_queue_id, td::TQueue::EventId());
+  auto r_id = parameters_->shared_data_->tqueue_->push(
+      tqueue_id_, pack_update(update_slice, static_cast<size_t>(parameters_->update_compression_threshold_)),
+      get_unix_time() + timeout, webhook_queue_id, td::TQueue::EventId());
   if (r_id.is_ok()) {
     auto id = r_id.move_as_ok();
     LOG(DEBUG) << "Update " << id << " was added for " << timeout << " seconds: " << update_slice;
-    if (webhook_url_.empty()) {
+    if (!update_stream_connection_id_.empty()) {
+      schedule_update_stream_flush();
+    } else if (webhook_url_.empty()) {
+      if (long_poll_query_) {
+        long_poll_update_count_++;
+        long_poll_update_size_ += update_slice.size();
+      }
       long_poll_wakeup(false);
     } else {
       send_closure(webhook_id_, &WebhookActor::update);
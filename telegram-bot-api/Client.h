@@ -9,6 +9,7 @@
 #include "telegram-bot-api/Query.h"
 #include "telegram-bot-api/Stats.h"
 #include "telegram-bot-api/WebhookActor.h"
+#include "telegram-bot-api/WebhookConfig.h"
 
 #include "td/telegram/ClientActor.h"
 #include "td/telegram/td_api.h"
@@ -27,15 +28,18 @@
 #include "td/utils/Promise.h"
 #include "td/utils/Slice.h"
 #include "td/utils/Status.h"
+#include "td/utils/VectorQueue.h"
 #include "td/utils/WaitFreeHashMap.h"
 
 #include <limits>
 #include <memory>
 #include <queue>
+#include <utility>
 
 namespace telegram_bot_api {
 
 struct ClientParameters;
+class HttpConnection;
 
 namespace td_api = td::td_api;
 
@@ -56,6 +60,16 @@ class Client final : public WebhookActor::Callback {
   // for stats
   ServerBotInfo get_bot_info() const;
 
+  // returns latency statistics of the bot, which are expensive to compute
+  td::vector<StatItem> get_latency_stats() const;
+
+  static constexpr td::int32 MAX_GET_UPDATES_LIMIT = 100;
+
+  static const Histogram &get_global_get_updates_batch_size();
+
+  // returns the method name with static storage duration, or "<other>" if the method is unknown
+  static td::Slice get_stat_method_name(td::Slice method);
+
  private:
   using int32 = td::int32;
   using int64 = td::int64;
@@ -70,6 +84,8 @@ class Client final : public WebhookActor::Callback {
   static constexpr int32 MAX_CERTIFICATE_FILE_SIZE = 3 << 20;
   static constexpr int32 MAX_DOWNLOAD_FILE_SIZE = 20 << 20;
 
+  static constexpr int32 MAX_WEBHOOK_BATCH_SIZE = 100;
+
   static constexpr int32 MAX_CONCURRENTLY_SENT_CHAT_MESSAGES = 310;  // some unreasonably big value
 
   static constexpr std::size_t MIN_PENDING_UPDATES_WARNING = 200;
@@ -771,6 +787,8 @@ class Client final : public WebhookActor::Callback {
 
   static bool init_methods();
 
+  static void init_methods_once();
+
   static bool is_local_method(td::Slice method);
 
   void on_cmd(PromisedQueryPtr query, bool force = false);
@@ -946,6 +964,8 @@ class Client final : public WebhookActor::Callback {
   td::Status process_send_custom_request_query(PromisedQueryPtr &query);
   td::Status process_answer_custom_query_query(PromisedQueryPtr &query);
   td::Status process_get_updates_query(PromisedQueryPtr &query);
+  td::Status process_stream_updates_query(PromisedQueryPtr &query);
+  td::Status process_ack_updates_query(PromisedQueryPtr &query);
   td::Status process_set_webhook_query(PromisedQueryPtr &query);
   td::Status process_get_webhook_info_query(PromisedQueryPtr &query);
   td::Status process_get_file_query(PromisedQueryPtr &query);
@@ -957,7 +977,7 @@ class Client final : public WebhookActor::Callback {
   void hangup_shared() final;
   const td::HttpFile *get_webhook_certificate(const Query *query) const;
   int32 get_webhook_max_connections(const Query *query) const;
-  static bool get_webhook_fix_ip_address(const Query *query);
+  td::Result<WebhookConfig> get_webhook_config(const Query *query) const;
   void do_set_webhook(PromisedQueryPtr query, bool was_deleted);
   void on_webhook_certificate_copied(td::Status status);
   void finish_set_webhook(PromisedQueryPtr query);
@@ -1024,10 +1044,26 @@ class Client final : public WebhookActor::Callback {
   static bool is_special_error_code(int32 error_code);
 
   class JsonUpdates;
-  void do_get_updates(int32 offset, int32 limit, int32 timeout, PromisedQueryPtr query);
+  struct LongPollCoalescingPolicy {
+    double max_delay_ = LONG_POLL_MAX_DELAY;
+    int32 min_update_count_ = 0;
+    std::size_t min_update_size_ = 0;
+  };
+  void do_get_updates(int32 offset, int32 limit, int32 timeout, const LongPollCoalescingPolicy &policy,
+                      PromisedQueryPtr query);
 
   void long_poll_wakeup(bool force_flag);
 
+  void forget_updates(int32 offset);
+
+  void schedule_update_stream_flush();
+
+  void flush_update_stream();
+
+  void close_update_stream();
+
+  void on_update_stream_closed(int64 generation);
+
   void start_up() final;
 
   void raw_event(const td::Event::Raw &event) final;
@@ -1428,7 +1464,7 @@ class Client final : public WebhookActor::Callback {
 
   static td::uint32 get_allowed_update_types(td::MutableSlice allowed_updates, bool is_internal);
 
-  bool update_allowed_update_types(const Query *query);
+  bool update_allowed_update_types(td::uint32 allowed_update_types);
 
   template <class T>
   void add_update(UpdateType update_type, const T &update, int32 timeout, int64 webhook_queue_id);
@@ -1610,13 +1646,32 @@ class Client final : public WebhookActor::Callback {
   static constexpr int32 LONG_POLL_MAX_TIMEOUT = 50;
   static constexpr double LONG_POLL_MAX_DELAY = 0.002;
   static constexpr double LONG_POLL_WAIT_AFTER = 0.001;
+  static constexpr int32 LONG_POLL_MAX_COALESCING_DELAY = 1000;  // in milliseconds
+  static constexpr int32 LONG_POLL_MAX_COALESCING_UPDATE_SIZE = 1 << 22;
   int32 long_poll_limit_ = 0;
   int32 long_poll_offset_ = 0;
+  LongPollCoalescingPolicy long_poll_policy_;
+  int32 long_poll_update_count_ = 0;
+  std::size_t long_poll_update_size_ = 0;
+  Histogram get_updates_batch_size_{MAX_GET_UPDATES_LIMIT};
   bool long_poll_was_wakeup_ = false;
   double long_poll_hard_timeout_ = 0;
   td::Slot long_poll_slot_;
   PromisedQueryPtr long_poll_query_;
 
+  static constexpr int32 UPDATE_STREAM_DEFAULT_MAX_UNACKNOWLEDGED_UPDATES = 1000;
+  static constexpr int32 UPDATE_STREAM_MAX_UNACKNOWLEDGED_UPDATES = 100000;
+  static constexpr std::size_t UPDATE_STREAM_MAX_UNACKNOWLEDGED_SIZE = 16 << 20;
+  static constexpr std::size_t UPDATE_STREAM_MAX_CHUNK_SIZE = 1 << 20;
+  td::ActorId<HttpConnection> update_stream_connection_id_;
+  int64 update_stream_generation_ = 0;
+  int32 update_stream_max_unacknowledged_updates_ = UPDATE_STREAM_DEFAULT_MAX_UNACKNOWLEDGED_UPDATES;
+  td::TQueue::EventId update_stream_offset_;  // identifier of the next update to be sent
+  // identifiers of the next update after each sent chunk together with sizes of the chunks
+  td::VectorQueue<std::pair<td::TQueue::EventId, std::size_t>> update_stream_chunks_;
+  std::size_t update_stream_unacknowledged_size_ = 0;
+  bool is_update_stream_flush_scheduled_ = false;
+
   static constexpr int32 BOT_UPDATES_WARNING_DELAY = 30;
   double next_bot_updates_warning_time_ = 0;
   bool was_bot_updates_warning_ = false;
@@ -1629,12 +1684,15 @@ class Client final : public WebhookActor::Callback {
   td::ActorOwn<WebhookActor> webhook_id_;
   PromisedQueryPtr webhook_set_query_;
   PromisedQueryPtr active_webhook_set_query_;
+  WebhookConfig pending_webhook_config_;  // parsed parameters of webhook_set_query_ or active_webhook_set_query_
   td::string webhook_url_;
   double webhook_set_time_ = 0;
   int32 webhook_max_connections_ = 0;
+  int32 webhook_batch_size_ = 0;
   td::string webhook_ip_address_;
   bool webhook_fix_ip_address_ = false;
   td::string webhook_secret_token_;
+  std::shared_ptr<WebhookLatencyStats> webhook_latency_stats_;
   int32 last_webhook_error_date_ = 0;
   td::Status last_webhook_error_;
   double next_allowed_set_webhook_time_ = 0;
@@ -7,7 +7,9 @@
 #include "telegram-bot-api/ClientManager.h"
 
 #include "telegram-bot-api/ClientParameters.h"
+#include "telegram-bot-api/Metrics.h"
 #include "telegram-bot-api/WebhookActor.h"
+#include "telegram-bot-api/WebhookConnectionPool.h"
 
 #include "td/telegram/ClientActor.h"
 #include "td/telegram/td_api.h"
@@ -22,24 +24,30 @@
 
 #include "td/actor/MultiPromise.h"
 
+#include "td/utils/algorithm.h"
 #include "td/utils/common.h"
 #include "td/utils/format.h"
+#include "td/utils/JsonBuilder.h"
 #include "td/utils/logging.h"
 #include "td/utils/misc.h"
-#include "td/utils/Parser.h"
 #include "td/utils/port/IPAddress.h"
 #include "td/utils/port/Stat.h"
 #include "td/utils/port/thread.h"
 #include "td/utils/Slice.h"
 #include "td/utils/SliceBuilder.h"
+#include "td/utils/Span.h"
 #include "td/utils/StackAllocator.h"
 #include "td/utils/StringBuilder.h"
 #include "td/utils/Time.h"
+#include "td/utils/utf8.h"
 
 #include "memprof/memprof.h"
 
 #include <algorithm>
 #include <atomic>
+#include <functional>
+#include <iterator>
+#include <memory>
 #include <tuple>
 
 namespace telegram_bot_api {
@@ -53,6 +61,11 @@ void ClientManager::close(td::Promise<td::Unit> &&promise) {
   close_flag_ = true;
   watchdog_id_.reset();
   dump_statistics();
+  new_bot_stat_snapshot_ = nullptr;
+  for (auto &query : pending_bots_json_stats_queries_) {
+    query.second.set_error(td::Status::Error(500, "Closing"));
+  }
+  pending_bots_json_stats_queries_.clear();
   auto ids = clients_.ids();
   for (auto id : ids) {
     auto *client_info = clients_.get(id);
@@ -105,7 +118,8 @@ void ClientManager::send(PromisedQueryPtr query) {
       }
     }
     LOG(DEBUG) << "Receive incoming query for new bot " << token << " from " << ip_address;
-    if (!ip_address.empty()) {
+    // internal queries restore stored webhooks, which must not be lost because of the flood control
+    if (!ip_address.empty() && !query->is_internal()) {
       LOG(DEBUG) << "Check Client creation flood control for IP address " << ip_address;
       auto res = flood_controls_.emplace(std::move(ip_address), td::FloodControlFast());
       auto &flood_control = res.first->second;
@@ -121,7 +135,7 @@ void ClientManager::send(PromisedQueryPtr query) {
       }
       flood_control.add_event(now);
     }
-    if (is_global_flood_control_enabled_) {
+    if (is_global_flood_control_enabled_ && !query->is_internal()) {
       auto now = td::Time::now();
       auto wakeup_at = global_flood_control_.get_wakeup_at();
       if (wakeup_at > now) {
@@ -134,10 +148,13 @@ void ClientManager::send(PromisedQueryPtr query) {
     if (active_client_count_.count(tqueue_id) != 0) {
       // return query->set_retry_after_error(1);
     }
+    add_tqueue_id(tqueue_id);
 
     auto id =
         clients_.create(ClientInfo{BotStatActor(stat_.actor_id(&stat_)), token, tqueue_id, td::ActorOwn<Client>()});
     auto *client_info = clients_.get(id);
+    client_info->stat_.set_id(id);
+    tqueue_id_to_id_[tqueue_id] = id;
     client_info->client_ = td::create_actor<Client>(PSLICE() << "Client/" << token, actor_shared(this, id),
                                                     query->token().str(), query->is_test_dc(), tqueue_id, parameters_,
                                                     client_info->stat_.actor_id(&client_info->stat_));
@@ -147,7 +164,8 @@ void ClientManager::send(PromisedQueryPtr query) {
       auto webhook_info = parameters_->shared_data_->webhook_db_->get(bot_token_with_dc);
       if (!webhook_info.empty()) {
         send_closure(client_info->client_, &Client::send,
-                     get_webhook_restore_query(bot_token_with_dc, webhook_info, parameters_->shared_data_));
+                     get_webhook_restore_query(bot_token_with_dc, webhook_info, parameters_->shared_data_,
+                                               td::Promise<td::unique_ptr<Query>>()));
       }
     }
 
@@ -161,23 +179,37 @@ ClientManager::TopClients ClientManager::get_top_clients(std::size_t max_count,
   auto now = td::Time::now();
   TopClients result;
   td::vector<std::pair<td::int64, td::uint64>> top_client_ids;
-  for (auto id : clients_.ids()) {
-    auto *client_info = clients_.get(id);
-    CHECK(client_info);
-
-    if (client_info->stat_.is_active(now)) {
-      result.active_count++;
+  auto add_client = [&](td::uint64 id, BotStatActor &stat) {
+    auto score = static_cast<td::int64>(stat.get_score(now) * -1e9);
+    if (score == 0 && top_client_ids.size() >= max_count) {
+      return;
     }
+    top_client_ids.emplace_back(score, id);
+  };
 
-    if (!td::begins_with(client_info->token_, token_filter)) {
-      continue;
-    }
+  result.active_count = stat_.get_daily_active_child_count(now);
 
-    auto score = static_cast<td::int64>(client_info->stat_.get_score(now) * -1e9);
-    if (score == 0 && top_client_ids.size() >= max_count) {
-      continue;
+  if (!token_filter.empty()) {
+    for (auto id : clients_.ids()) {
+      auto *client_info = clients_.get(id);
+      CHECK(client_info);
+      if (td::begins_with(client_info->token_, token_filter)) {
+        add_client(id, client_info->stat_);
+      }
+    }
+  } else {
+    for (auto id : get_recently_active_client_ids(now)) {
+      add_client(id, clients_.get(id)->stat_);
+    }
+    remove_deleted_idle_top_clients();
+    for (auto &idle_client : idle_top_clients_) {
+      auto id = idle_client.second;
+      auto *client_info = clients_.get(id);
+      CHECK(client_info != nullptr);
+      if (!client_info->stat_.is_recently_active(now)) {  // otherwise, the client has already been added
+        add_client(id, client_info->stat_);
+      }
     }
-    top_client_ids.emplace_back(score, id);
   }
   if (top_client_ids.size() < max_count) {
     max_count = top_client_ids.size();
@@ -190,6 +222,56 @@ ClientManager::TopClients ClientManager::get_top_clients(std::size_t max_count,
   return result;
 }
 
+const td::vector<td::uint64> &ClientManager::get_recently_active_client_ids(double now) {
+  auto &client_ids = stat_.get_recently_active_child_ids();
+  std::size_t kept_count = 0;
+  for (auto id : client_ids) {
+    auto *client_info = clients_.get(id);
+    if (client_info == nullptr) {
+      continue;
+    }
+    if (!client_info->stat_.is_recently_active(now)) {
+      client_info->stat_.on_removed_from_recently_active_list();
+      add_idle_top_client(id, client_info->stat_.get_score(now));
+      continue;
+    }
+    client_ids[kept_count++] = id;
+  }
+  client_ids.resize(kept_count);
+  return client_ids;
+}
+
+void ClientManager::add_idle_top_client(td::uint64 id, double score) {
+  if (score <= 0.0 || idle_top_client_ids_.count(id) != 0) {
+    return;
+  }
+  if (idle_top_clients_.size() >= MAX_IDLE_TOP_CLIENT_COUNT) {
+    if (score <= idle_top_clients_[0].first) {
+      return;
+    }
+    std::pop_heap(idle_top_clients_.begin(), idle_top_clients_.end(), std::greater<std::pair<double, td::uint64>>());
+    idle_top_client_ids_.erase(idle_top_clients_.back().second);
+    idle_top_clients_.pop_back();
+  }
+  idle_top_clients_.emplace_back(score, id);
+  std::push_heap(idle_top_clients_.begin(), idle_top_clients_.end(), std::greater<std::pair<double, td::uint64>>());
+  idle_top_client_ids_.insert(id);
+}
+
+void ClientManager::remove_deleted_idle_top_clients() {
+  auto old_size = idle_top_clients_.size();
+  td::remove_if(idle_top_clients_, [&](const std::pair<double, td::uint64> &idle_client) {
+    if (clients_.get(idle_client.second) != nullptr) {
+      return false;
+    }
+    idle_top_client_ids_.erase(idle_client.second);
+    return true;
+  });
+  if (idle_top_clients_.size() != old_size) {
+    std::make_heap(idle_top_clients_.begin(), idle_top_clients_.end(), std::greater<std::pair<double, td::uint64>>());
+  }
+}
+
 void ClientManager::get_stats(td::Promise<td::BufferSlice> promise,
                               td::vector<std::pair<td::string, td::string>> args) {
   if (close_flag_) {
@@ -250,12 +332,31 @@ void ClientManager::get_stats(td::Promise<td::BufferSlice> promise,
 
     sb << "buffer_memory\t" << td::format::as_size(td::BufferAllocator::get_buffer_mem()) << '\n';
     sb << "active_webhook_connections\t" << WebhookActor::get_total_connection_count() << '\n';
+    sb << "idle_webhook_connections\t" << WebhookConnectionPool::get_idle_connection_count() << '\n';
+    sb << "webhook_connections_per_thread\t"
+       << td::format::as_array(WebhookActor::get_thread_connection_counts(parameters_->webhook_thread_count_))
+       << '\n';
     sb << "active_requests\t" << parameters_->shared_data_->query_count_.load(std::memory_order_relaxed) << '\n';
     sb << "active_network_queries\t" << td::get_pending_network_query_count(*parameters_->net_query_stats_) << '\n';
+    if (!pending_webhook_restores_.empty() || active_webhook_restore_count_ != 0) {
+      sb << "pending_webhook_restore_count\t" << pending_webhook_restores_.size() << '\n';
+      sb << "active_webhook_restore_count\t" << active_webhook_restore_count_ << '\n';
+    }
+    sb << "tqueue_gc_deleted_events\t" << tqueue_deleted_events_ << '\n';
+    sb << "tqueue_gc_max_pass_duration\t" << tqueue_gc_max_pass_duration_ << '\n';
+    for (auto &stat : WebhookActor::get_global_latency_stats().as_vector()) {
+      sb << stat.key_ << '\t' << stat.value_ << '\n';
+    }
+    if (Client::get_global_get_updates_batch_size().get_count() != 0) {
+      sb << "get_updates_batch_size\t" << Client::get_global_get_updates_batch_size().get_percentiles() << '\n';
+    }
     auto stats = stat_.as_vector(now);
     for (auto &stat : stats) {
       sb << stat.key_ << "\t" << stat.value_ << '\n';
     }
+    for (auto &method_stat : stat_.get_method_stats()) {
+      sb << "method_" << method_stat.first << '\t' << method_stat.second->get_description() << '\n';
+    }
   }
 
   for (auto top_client_id : top_clients.top_client_ids) {
@@ -294,6 +395,9 @@ void ClientManager::get_stats(td::Promise<td::BufferSlice> promise,
       sb << "tail_update_id\t" << bot_info.tail_update_id_ << '\n';
       sb << "pending_update_count\t" << bot_info.pending_update_count_ << '\n';
     }
+    for (auto &stat : client_info->client_.get_actor_unsafe()->get_latency_stats()) {
+      sb << stat.key_ << '\t' << stat.value_ << '\n';
+    }
 
     auto stats = client_info->stat_.as_vector(now);
     for (auto &stat : stats) {
@@ -302,6 +406,13 @@ void ClientManager::get_stats(td::Promise<td::BufferSlice> promise,
       }
     }
 
+    // show only the most used methods of each bot
+    constexpr std::size_t MAX_SHOWN_METHOD_COUNT = 10;
+    auto method_stats = client_info->stat_.get_method_stats();
+    for (std::size_t i = 0; i < method_stats.size() && i < MAX_SHOWN_METHOD_COUNT; i++) {
+      sb << "method_" << method_stats[i].first << '\t' << method_stats[i].second->get_description() << '\n';
+    }
+
     if (sb.is_error()) {
       break;
     }
@@ -310,6 +421,432 @@ void ClientManager::get_stats(td::Promise<td::BufferSlice> promise,
   promise.set_value(td::BufferSlice(sb.as_cslice()));
 }
 
+void ClientManager::get_metrics(td::Promise<td::BufferSlice> promise,
+                                td::vector<std::pair<td::string, td::string>> args) {
+  if (close_flag_) {
+    return promise.set_error(td::Status::Error(500, "Closing"));
+  }
+
+  auto max_bot_count = DEFAULT_METRICS_BOT_COUNT;
+  for (auto &arg : args) {
+    if (arg.first == "top") {
+      auto r_max_bot_count = td::to_integer_safe<std::size_t>(arg.second);
+      if (r_max_bot_count.is_ok()) {
+        max_bot_count = td::min(r_max_bot_count.ok(), MAX_METRICS_BOT_COUNT);
+      }
+    }
+  }
+
+  auto now = td::Time::now();
+  auto top_clients = get_top_clients(max_bot_count, td::Slice());
+
+  OpenMetricsBuilder builder;
+  auto add_gauge = [&builder](td::Slice name, td::Slice help, auto value) {
+    builder.add_family(name, "gauge", help);
+    builder.add_sample(name, td::Slice(), value);
+  };
+  auto add_counter = [&builder](td::Slice name, td::Slice help, auto value) {
+    builder.add_family(name, "counter", help);
+    builder.add_sample(PSLICE() << name << "_total", td::Slice(), value);
+  };
+
+  add_gauge("telegram_bot_api_uptime_seconds", "Time since the server start", now - parameters_->start_time_);
+  add_gauge("telegram_bot_api_bots", "Number of bots", clients_.size());
+  add_gauge("telegram_bot_api_active_bots", "Number of bots active during the last day", top_clients.active_count);
+
+  auto r_mem_stat = td::mem_stat();
+  if (r_mem_stat.is_ok()) {
+    auto mem_stat = r_mem_stat.move_as_ok();
+    add_gauge("telegram_bot_api_resident_memory_bytes", "Resident memory size", mem_stat.resident_size_);
+    add_gauge("telegram_bot_api_virtual_memory_bytes", "Virtual memory size", mem_stat.virtual_size_);
+    add_gauge("telegram_bot_api_resident_memory_peak_bytes", "Peak resident memory size",
+              mem_stat.resident_size_peak_);
+    add_gauge("telegram_bot_api_virtual_memory_peak_bytes", "Peak virtual memory size", mem_stat.virtual_size_peak_);
+  }
+
+  auto cpu_usage = ServerCpuStat::instance().get_usage(now);
+  if (!cpu_usage.empty()) {
+    builder.add_family("telegram_bot_api_cpu_usage", "gauge", "Average number of used CPU cores");
+    for (auto &usage : cpu_usage) {
+      auto duration_label = OpenMetricsBuilder::label("duration", usage.first);
+      builder.add_sample("telegram_bot_api_cpu_usage", PSLICE() << duration_label << ",mode=\"user\"",
+                         usage.second.user_);
+      builder.add_sample("telegram_bot_api_cpu_usage", PSLICE() << duration_label << ",mode=\"system\"",
+                         usage.second.system_);
+    }
+  }
+
+  add_gauge("telegram_bot_api_buffer_memory_bytes", "Size of memory used by buffers",
+            td::BufferAllocator::get_buffer_mem());
+  builder.add_family("telegram_bot_api_webhook_connections", "gauge", "Number of webhook connections");
+  builder.add_sample("telegram_bot_api_webhook_connections", "state=\"active\"",
+                     WebhookActor::get_total_connection_count());
+  builder.add_sample("telegram_bot_api_webhook_connections", "state=\"idle\"",
+                     WebhookConnectionPool::get_idle_connection_count());
+  add_gauge("telegram_bot_api_active_requests", "Number of requests being processed",
+            parameters_->shared_data_->query_count_.load(std::memory_order_relaxed));
+  add_gauge("telegram_bot_api_pending_network_queries", "Number of pending queries to Telegram servers",
+            td::get_pending_network_query_count(*parameters_->net_query_stats_));
+  add_gauge("telegram_bot_api_pending_webhook_restores", "Number of webhooks waiting to be restored",
+            pending_webhook_restores_.size());
+  add_counter("telegram_bot_api_tqueue_gc_deleted_events", "Number of updates deleted by the garbage collector",
+              tqueue_deleted_events_);
+
+  auto total_stat = stat_.get_total_stat(now);
+  add_counter("telegram_bot_api_requests", "Number of received requests", total_stat.request_count_);
+  add_counter("telegram_bot_api_request_bytes", "Total size of received requests", total_stat.request_bytes_);
+  builder.add_family("telegram_bot_api_responses", "counter", "Number of sent responses");
+  builder.add_sample("telegram_bot_api_responses_total", "result=\"ok\"", total_stat.response_count_ok_);
+  builder.add_sample("telegram_bot_api_responses_total", "result=\"error\"", total_stat.response_count_error_);
+  add_counter("telegram_bot_api_response_bytes", "Total size of sent responses", total_stat.response_bytes_);
+  add_counter("telegram_bot_api_updates", "Number of received updates", total_stat.update_count_);
+
+  auto add_histogram = [&builder](td::Slice name, td::Slice help, const Histogram &histogram, double scale) {
+    builder.add_family(name, "histogram", help);
+    builder.add_histogram(name, td::Slice(), histogram, scale);
+  };
+  auto &latency_stats = WebhookActor::get_global_latency_stats();
+  add_histogram("telegram_bot_api_webhook_first_send_latency_seconds",
+                "Time from receiving of an update to the first attempt to send it to a webhook",
+                latency_stats.first_send_.get_histogram(), 1e-6);
+  add_histogram("telegram_bot_api_webhook_response_latency_seconds",
+                "Time from sending of a webhook request to receiving of a successful response",
+                latency_stats.response_.get_histogram(), 1e-6);
+  add_histogram("telegram_bot_api_webhook_delivery_latency_seconds",
+                "Time from receiving of an update to its successful delivery to a webhook",
+                latency_stats.delivery_.get_histogram(), 1e-6);
+  add_histogram("telegram_bot_api_get_updates_batch_size", "Number of updates returned by getUpdates",
+                Client::get_global_get_updates_batch_size(), 1.0);
+
+  auto method_stats = stat_.get_method_stats();
+  td::vector<td::string> method_labels;
+  method_labels.reserve(method_stats.size());
+  for (auto &method_stat : method_stats) {
+    method_labels.push_back(OpenMetricsBuilder::label("method", method_stat.first));
+  }
+  builder.add_family("telegram_bot_api_method_requests", "counter", "Number of answered requests by method");
+  for (std::size_t i = 0; i < method_stats.size(); i++) {
+    builder.add_sample("telegram_bot_api_method_requests_total", method_labels[i],
+                       method_stats[i].second->request_count_);
+  }
+  builder.add_family("telegram_bot_api_method_errors", "counter",
+                     "Number of requests answered with an error by method");
+  for (std::size_t i = 0; i < method_stats.size(); i++) {
+    builder.add_sample("telegram_bot_api_method_errors_total", method_labels[i], method_stats[i].second->error_count_);
+  }
+  builder.add_family("telegram_bot_api_method_latency_seconds", "histogram",
+                     "Time from receiving of a request to sending of the response by method");
+  for (std::size_t i = 0; i < method_stats.size(); i++) {
+    // aggregate statistics always have latency histograms
+    CHECK(method_stats[i].second->latency_ != nullptr);
+    builder.add_histogram("telegram_bot_api_method_latency_seconds", method_labels[i],
+                          method_stats[i].second->latency_->get_histogram(), 1e-6);
+  }
+
+  // per-bot metrics are returned only for the most active bots to keep the response small
+  struct BotMetrics {
+    td::string label_;
+    ServerBotStat total_stat_;
+    td::int64 active_request_count_;
+    std::size_t pending_update_count_;
+  };
+  td::vector<BotMetrics> bot_metrics;
+  bot_metrics.reserve(top_clients.top_client_ids.size());
+  for (auto top_client_id : top_clients.top_client_ids) {
+    auto *client_info = clients_.get(top_client_id);
+    CHECK(client_info);
+    auto client = client_info->client_.get_actor_unsafe();
+    auto bot_info = client->get_bot_info();
+    BotMetrics metrics;
+    metrics.label_ = OpenMetricsBuilder::label("bot_id", bot_info.id_);
+    metrics.total_stat_ = client_info->stat_.get_total_stat(now);
+    metrics.active_request_count_ = client_info->stat_.get_active_request_count();
+    metrics.pending_update_count_ = bot_info.pending_update_count_;
+    bot_metrics.push_back(std::move(metrics));
+  }
+  auto add_bot_family = [&builder, &bot_metrics](td::Slice name, td::Slice type, td::Slice help, auto get_value) {
+    builder.add_family(name, type, help);
+    td::string sample_name = type == "counter" ? PSTRING() << name << "_total" : name.str();
+    for (auto &metrics : bot_metrics) {
+      builder.add_sample(sample_name, metrics.label_, get_value(metrics));
+    }
+  };
+  add_bot_family("telegram_bot_api_bot_requests", "counter", "Number of requests received from the bot",
+                 [](const BotMetrics &metrics) { return metrics.total_stat_.request_count_; });
+  add_bot_family("telegram_bot_api_bot_updates", "counter", "Number of updates received for the bot",
+                 [](const BotMetrics &metrics) { return metrics.total_stat_.update_count_; });
+  add_bot_family("telegram_bot_api_bot_active_requests", "gauge", "Number of requests of the bot being processed",
+                 [](const BotMetrics &metrics) { return metrics.active_request_count_; });
+  add_bot_family("telegram_bot_api_bot_pending_updates", "gauge", "Number of pending updates of the bot",
+                 [](const BotMetrics &metrics) { return metrics.pending_update_count_; });
+
+  promise.set_value(td::BufferSlice(builder.finish()));
+}
+
+class JsonBotStat final : public td::Jsonable {
+ public:
+  JsonBotStat(const BotStatSnapshot &bot, double now) : bot_(bot), now_(now) {
+  }
+  JsonBotStat(const BotStatSnapshot &bot, double now, const td::vector<StatItem> *latency_stats,
+              const td::vector<std::pair<td::Slice, const MethodStat *>> *method_stats)
+      : bot_(bot), now_(now), latency_stats_(latency_stats), method_stats_(method_stats) {
+  }
+  void store(td::JsonValueScope *scope) const {
+    auto object = scope->enter_object();
+    auto add_string = [&object](td::Slice key, td::CSlice value) {
+      if (td::check_utf8(value)) {
+        object(key, value);
+      } else {
+        object(key, td::JsonRawString(value));
+      }
+    };
+    auto add_size = [&object](td::Slice key, std::size_t value) {
+      object(key, td::JsonLong(static_cast<td::int64>(value)));
+    };
+    const auto &info = bot_.info_;
+    object("id", info.id_);
+    add_string("username", info.username_);
+    object("uptime", td::JsonFloat(now_ - info.start_time_));
+    if (!info.webhook_.empty()) {
+      add_string("webhook_url", info.webhook_);
+      object("has_custom_certificate", td::JsonBool(info.has_webhook_certificate_));
+      object("webhook_max_connections", info.webhook_max_connections_);
+      add_size("webhook_connection_count", info.webhook_connection_count_);
+      add_size("webhook_active_request_count", info.webhook_active_request_count_);
+    }
+    if (info.last_webhook_error_date_ > 0) {
+      object("last_webhook_error_date", info.last_webhook_error_date_);
+      add_string("last_webhook_error_message", info.last_webhook_error_message_);
+    }
+    object("head_update_id", info.head_update_id_);
+    object("tail_update_id", info.tail_update_id_);
+    add_size("pending_update_count", info.pending_update_count_);
+    object("active_request_count", td::JsonLong(bot_.active_request_count_));
+    object("active_file_upload_bytes", td::JsonLong(bot_.active_file_upload_bytes_));
+    object("active_file_upload_count", td::JsonLong(bot_.active_file_upload_count_));
+    object("request_rate", td::JsonFloat(bot_.minute_stat_.request_count_));
+    object("update_rate", td::JsonFloat(bot_.minute_stat_.update_count_));
+    object("score", td::JsonFloat(bot_.score_));
+    if (latency_stats_ != nullptr) {
+      object("latency_stats", td::json_object([latency_stats = latency_stats_](auto &o) {
+               for (auto &stat : *latency_stats) {
+                 o(stat.key_, stat.value_);
+               }
+             }));
+    }
+    if (method_stats_ != nullptr) {
+      object("method_stats", td::json_array(*method_stats_, [](const auto &method_stat) {
+               return td::json_object([&method_stat](auto &o) {
+                 o("method", td::JsonRawString(method_stat.first));
+                 o("request_count", td::JsonLong(static_cast<td::int64>(method_stat.second->request_count_)));
+                 o("error_count", td::JsonLong(static_cast<td::int64>(method_stat.second->error_count_)));
+                 o("average_latency", td::JsonFloat(method_stat.second->get_average_duration()));
+                 if (method_stat.second->latency_ != nullptr) {
+                   o("latency", method_stat.second->latency_->get_percentiles());
+                 }
+               });
+             }));
+    }
+  }
+
+ private:
+  const BotStatSnapshot &bot_;
+  double now_;
+  const td::vector<StatItem> *latency_stats_ = nullptr;
+  const td::vector<std::pair<td::Slice, const MethodStat *>> *method_stats_ = nullptr;
+};
+
+class JsonBotStats final : public td::Jsonable {
+ public:
+  JsonBotStats(const td::vector<const BotStatSnapshot *> &bots, std::size_t total_count, double now)
+      : bots_(bots), total_count_(total_count), now_(now) {
+  }
+  void store(td::JsonValueScope *scope) const {
+    auto object = scope->enter_object();
+    object("total_count", td::JsonLong(static_cast<td::int64>(total_count_)));
+    object("bots", td::json_array(bots_, [now = now_](const BotStatSnapshot *bot) { return JsonBotStat(*bot, now); }));
+  }
+
+ private:
+  const td::vector<const BotStatSnapshot *> &bots_;
+  std::size_t total_count_;
+  double now_;
+};
+
+BotStatSnapshot ClientManager::get_bot_stat(ClientInfo *client_info, double now) {
+  BotStatSnapshot bot;
+  bot.info_ = client_info->client_.get_actor_unsafe()->get_bot_info();
+  bot.minute_stat_ = client_info->stat_.get_minute_stat(now);
+  bot.score_ = client_info->stat_.get_score(now);
+  bot.active_request_count_ = client_info->stat_.get_active_request_count();
+  bot.active_file_upload_bytes_ = client_info->stat_.get_active_file_upload_bytes();
+  bot.active_file_upload_count_ = client_info->stat_.get_active_file_upload_count();
+  return bot;
+}
+
+void ClientManager::run_bot_stat_snapshot_pass() {
+  CHECK(new_bot_stat_snapshot_ != nullptr);
+  auto start_time = td::Time::now();
+  auto max_finish_time = start_time + BOT_STAT_SNAPSHOT_MAX_PASS_DURATION;
+  while (bot_stat_snapshot_next_queue_index_ < tqueue_ids_.size()) {
+    auto it = tqueue_id_to_id_.find(tqueue_ids_[bot_stat_snapshot_next_queue_index_++]);
+    if (it == tqueue_id_to_id_.end()) {
+      continue;
+    }
+    new_bot_stat_snapshot_->push_back(get_bot_stat(clients_.get(it->second), start_time));
+    if (td::Time::now() >= max_finish_time) {
+      return;
+    }
+  }
+
+  LOG(INFO) << "Built statistics snapshot of " << new_bot_stat_snapshot_->size() << " bots";
+  bot_stat_snapshot_ = std::make_shared<const td::vector<BotStatSnapshot>>(std::move(*new_bot_stat_snapshot_));
+  bot_stat_snapshot_time_ = td::Time::now();
+  new_bot_stat_snapshot_ = nullptr;
+  bot_stat_snapshot_next_queue_index_ = 0;
+
+  auto queries = std::move(pending_bots_json_stats_queries_);
+  pending_bots_json_stats_queries_.clear();
+  for (auto &query : queries) {
+    send_bots_json_stats(std::move(query.first), std::move(query.second));
+  }
+}
+
+void ClientManager::send_bots_json_stats(td::vector<std::pair<td::string, td::string>> args,
+                                         td::Promise<td::BufferSlice> promise) {
+  CHECK(bot_stat_snapshot_ != nullptr);
+  // sorting and serialization of the snapshot are done on another thread to keep the client thread responsive
+  td::Scheduler::instance()->run_on_scheduler(
+      SharedData::get_statistics_thread_id(),
+      [snapshot = bot_stat_snapshot_, snapshot_time = bot_stat_snapshot_time_, args = std::move(args),
+       promise = std::move(promise)](td::Unit) mutable {
+        promise.set_value(get_bots_json_stats(*snapshot, snapshot_time, args));
+      });
+}
+
+td::BufferSlice ClientManager::get_bot_json_stats(td::Slice bot_id, double now) {
+  auto r_user_id = td::to_integer_safe<td::int64>(bot_id);
+  if (r_user_id.is_error() || r_user_id.ok() <= 0) {
+    return td::json_encode<td::BufferSlice>(JsonQueryError(400, "Bad Request: invalid bot identifier specified"));
+  }
+  for (auto is_test_dc : {false, true}) {
+    auto it = tqueue_id_to_id_.find(get_tqueue_id(r_user_id.ok(), is_test_dc));
+    if (it == tqueue_id_to_id_.end()) {
+      continue;
+    }
+    auto *client_info = clients_.get(it->second);
+    CHECK(client_info != nullptr);
+
+    auto bot = get_bot_stat(client_info, now);
+    auto latency_stats = client_info->client_.get_actor_unsafe()->get_latency_stats();
+    auto method_stats = client_info->stat_.get_method_stats();
+    JsonBotStat result(bot, now, &latency_stats, &method_stats);
+    return td::json_encode<td::BufferSlice>(JsonQueryOk<JsonBotStat>(result, td::Slice()));
+  }
+  return td::json_encode<td::BufferSlice>(JsonQueryError(404, "Not Found: bot not found"));
+}
+
+td::BufferSlice ClientManager::get_bots_json_stats(const td::vector<BotStatSnapshot> &snapshot, double snapshot_time,
+                                                   const td::vector<std::pair<td::string, td::string>> &args) {
+  using SortKey = double (*)(const BotStatSnapshot &bot);
+  static const std::pair<const char *, SortKey> SORT_KEYS[] = {
+      {"score", [](const BotStatSnapshot &bot) { return bot.score_; }},
+      {"pending_update_count",
+       [](const BotStatSnapshot &bot) { return static_cast<double>(bot.info_.pending_update_count_); }},
+      {"request_rate", [](const BotStatSnapshot &bot) { return bot.minute_stat_.request_count_; }},
+      {"update_rate", [](const BotStatSnapshot &bot) { return bot.minute_stat_.update_count_; }},
+      {"active_request_count",
+       [](const BotStatSnapshot &bot) { return static_cast<double>(bot.active_request_count_); }},
+      {"active_file_upload_bytes",
+       [](const BotStatSnapshot &bot) { return static_cast<double>(bot.active_file_upload_bytes_); }},
+      {"webhook_connection_count",
+       [](const BotStatSnapshot &bot) { return static_cast<double>(bot.info_.webhook_connection_count_); }},
+      {"last_webhook_error_date",
+       [](const BotStatSnapshot &bot) { return static_cast<double>(bot.info_.last_webhook_error_date_); }}};
+
+  std::size_t offset = 0;
+  std::size_t limit = DEFAULT_JSON_STATS_BOT_COUNT;
+  SortKey sort_key = SORT_KEYS[0].second;
+  bool is_ascending = false;
+  td::Slice id_filter;
+  for (auto &arg : args) {
+    if (arg.first == "offset") {
+      offset = td::to_integer<std::size_t>(arg.second);
+    } else if (arg.first == "limit") {
+      limit =
+          td::clamp(td::to_integer<std::size_t>(arg.second), static_cast<std::size_t>(1), MAX_JSON_STATS_BOT_COUNT);
+    } else if (arg.first == "sort") {
+      auto it = std::find_if(std::begin(SORT_KEYS), std::end(SORT_KEYS),
+                             [&arg](const std::pair<const char *, SortKey> &key) { return arg.second == key.first; });
+      if (it == std::end(SORT_KEYS)) {
+        return td::json_encode<td::BufferSlice>(JsonQueryError(400, "Bad Request: unsupported sort key specified"));
+      }
+      sort_key = it->second;
+    } else if (arg.first == "order") {
+      is_ascending = arg.second == "asc";
+    } else if (arg.first == "id") {
+      id_filter = arg.second;
+    }
+  }
+
+  td::vector<const BotStatSnapshot *> bots;
+  bots.reserve(snapshot.size());
+  for (auto &bot : snapshot) {
+    if (td::begins_with(bot.info_.id_, id_filter)) {
+      bots.push_back(&bot);
+    }
+  }
+  auto total_count = bots.size();
+  offset = td::min(offset, total_count);
+  auto end = offset + td::min(total_count - offset, limit);
+  std::partial_sort(bots.begin(), bots.begin() + end, bots.end(),
+                    [sort_key, is_ascending](const BotStatSnapshot *lhs, const BotStatSnapshot *rhs) {
+                      auto lhs_value = sort_key(*lhs);
+                      auto rhs_value = sort_key(*rhs);
+                      if (lhs_value != rhs_value) {
+                        return is_ascending ? lhs_value < rhs_value : lhs_value > rhs_value;
+                      }
+                      return lhs->info_.id_ < rhs->info_.id_;
+                    });
+  td::vector<const BotStatSnapshot *> page(bots.begin() + offset, bots.begin() + end);
+  JsonBotStats result(page, total_count, snapshot_time);
+  return td::json_encode<td::BufferSlice>(JsonQueryOk<JsonBotStats>(result, td::Slice()));
+}
+
+void ClientManager::get_json_stats(td::Promise<td::BufferSlice> promise, td::string path,
+                                   td::vector<std::pair<td::string, td::string>> args) {
+  if (close_flag_) {
+    return promise.set_error(td::Status::Error(500, "Closing"));
+  }
+
+  auto now = td::Time::now();
+  if (path == "/json/bot") {
+    td::string bot_id;
+    for (auto &arg : args) {
+      if (arg.first == "id") {
+        bot_id = arg.second;
+      }
+    }
+    return promise.set_value(get_bot_json_stats(bot_id, now));
+  }
+  if (path != "/json/bots") {
+    return promise.set_value(td::json_encode<td::BufferSlice>(JsonQueryError(404, "Not Found")));
+  }
+
+  // building of a snapshot of all bots takes many timeouts, so the previous snapshot is returned while a new one
+  // is being built; only requests received before the first snapshot is built have to wait for it
+  if (new_bot_stat_snapshot_ == nullptr &&
+      (bot_stat_snapshot_ == nullptr || now >= bot_stat_snapshot_time_ + BOT_STAT_SNAPSHOT_UPDATE_PERIOD)) {
+    new_bot_stat_snapshot_ = td::make_unique<td::vector<BotStatSnapshot>>();
+    bot_stat_snapshot_next_queue_index_ = 0;
+  }
+  if (bot_stat_snapshot_ == nullptr) {
+    pending_bots_json_stats_queries_.emplace_back(std::move(args), std::move(promise));
+    return;
+  }
+  send_bots_json_stats(std::move(args), std::move(promise));
+}
+
 td::int64 ClientManager::get_tqueue_id(td::int64 user_id, bool is_test_dc) {
   return user_id + (static_cast<td::int64>(is_test_dc) << 54);
 }
@@ -353,6 +890,7 @@ void ClientManager::start_up() {
     LOG(WARNING) << "Loaded " << loaded_event_count << " TQueue events in " << (td::Time::now() - load_start_time)
                  << " seconds";
     next_tqueue_gc_time_ = td::Time::now() + 600;
+    next_tqueue_full_gc_time_ = next_tqueue_gc_time_;
   }
 
   // init webhook_db
@@ -363,26 +901,79 @@ void ClientManager::start_up() {
   parameters_->shared_data_->webhook_db_ = std::move(concurrent_webhook_db);
 
   auto &webhook_db = *parameters_->shared_data_->webhook_db_;
+  auto &tqueue = *parameters_->shared_data_->tqueue_;
+  td::vector<std::pair<std::size_t, td::string>> webhook_tokens;
   for (const auto &key_value : webhook_db.get_all()) {
     if (!token_range_(td::to_integer<td::uint64>(key_value.first))) {
-      LOG(WARNING) << "DROP WEBHOOK: " << key_value.first << " ---> " << key_value.second;
+      LOG(WARNING) << "DROP WEBHOOK: " << key_value.first;
       webhook_db.erase(key_value.first);
       continue;
     }
 
-    auto query = get_webhook_restore_query(key_value.first, key_value.second, parameters_->shared_data_);
-    send_closure_later(actor_id(this), &ClientManager::send, std::move(query));
+    auto tqueue_id = get_tqueue_id(td::to_integer<td::int64>(key_value.first), td::ends_with(key_value.first, ":T"));
+    webhook_tokens.emplace_back(tqueue.get_size(tqueue_id), key_value.first);
   }
 
+  // restore webhooks gradually, starting from bots with the most pending updates
+  std::sort(webhook_tokens.begin(), webhook_tokens.end());
+  pending_webhook_restores_.reserve(webhook_tokens.size());
+  for (auto &webhook_token : webhook_tokens) {
+    pending_webhook_restores_.push_back(std::move(webhook_token.second));
+  }
+  LOG(WARNING) << "Restore " << pending_webhook_restores_.size() << " webhooks";
+  restore_webhooks();
+
   // launch watchdog
   watchdog_id_ = td::create_actor_on_scheduler<Watchdog>("ManagerWatchdog", SharedData::get_watchdog_scheduler_id(),
                                                          td::this_thread::get_id(), WATCHDOG_TIMEOUT);
   set_timeout_in(600.0);
 }
 
+void ClientManager::restore_webhooks() {
+  auto &webhook_db = *parameters_->shared_data_->webhook_db_;
+  while (active_webhook_restore_count_ < MAX_ACTIVE_WEBHOOK_RESTORES && !pending_webhook_restores_.empty() &&
+         !close_flag_) {
+    auto bot_token_with_dc = std::move(pending_webhook_restores_.back());
+    pending_webhook_restores_.pop_back();
+
+    auto webhook_info = webhook_db.get(bot_token_with_dc);
+    if (webhook_info.empty()) {
+      // the webhook has already been deleted
+      continue;
+    }
+    td::string token = bot_token_with_dc;
+    if (td::ends_with(token, ":T")) {
+      token.resize(token.size() - 2);
+      token += "/test";
+    }
+    if (token_to_id_.count(token) != 0) {
+      // the webhook has already been restored during Client creation
+      continue;
+    }
+
+    active_webhook_restore_count_++;
+    auto promise = td::PromiseCreator::lambda([actor_id = actor_id(this)](td::Result<td::unique_ptr<Query>>) {
+      send_closure(actor_id, &ClientManager::on_webhook_restored);
+    });
+    auto query = get_webhook_restore_query(bot_token_with_dc, webhook_info, parameters_->shared_data_,
+                                           std::move(promise));
+    send_closure_later(actor_id(this), &ClientManager::send, std::move(query));
+  }
+}
+
+void ClientManager::on_webhook_restored() {
+  CHECK(active_webhook_restore_count_ > 0);
+  active_webhook_restore_count_--;
+  restore_webhooks();
+  if (active_webhook_restore_count_ == 0 && pending_webhook_restores_.empty() && !close_flag_) {
+    LOG(WARNING) << "Finished webhook restore in " << td::Time::now() - parameters_->start_time_ << " seconds";
+  }
+}
+
 PromisedQueryPtr ClientManager::get_webhook_restore_query(td::Slice token, td::Slice webhook_info,
-                                                          std::shared_ptr<SharedData> shared_data) {
-  // create Query with empty promise
+                                                          std::shared_ptr<SharedData> shared_data,
+                                                          td::Promise<td::unique_ptr<Query>> promise) {
+  // the webhook parameters are parsed by the Client itself, the query is used only to pass them
   td::vector<td::BufferSlice> containers;
   auto add_string = [&containers](td::Slice str) {
     containers.emplace_back(str);
@@ -391,7 +982,7 @@ PromisedQueryPtr ClientManager::get_webhook_restore_query(td::Slice token, td::S
 
   token = add_string(token);
 
-  LOG(WARNING) << "WEBHOOK: " << token << " ---> " << webhook_info;
+  LOG(WARNING) << "WEBHOOK: " << token;
 
   bool is_test_dc = false;
   if (td::ends_with(token, ":T")) {
@@ -399,44 +990,14 @@ PromisedQueryPtr ClientManager::get_webhook_restore_query(td::Slice token, td::S
     is_test_dc = true;
   }
 
-  td::ConstParser parser{webhook_info};
   td::vector<std::pair<td::MutableSlice, td::MutableSlice>> args;
-  if (parser.try_skip("cert/")) {
-    args.emplace_back(add_string("certificate"), add_string("previous"));
-  }
-
-  if (parser.try_skip("#maxc")) {
-    args.emplace_back(add_string("max_connections"), add_string(parser.read_till('/')));
-    parser.skip('/');
-  }
-
-  if (parser.try_skip("#ip")) {
-    args.emplace_back(add_string("ip_address"), add_string(parser.read_till('/')));
-    parser.skip('/');
-  }
-
-  if (parser.try_skip("#fix_ip")) {
-    args.emplace_back(add_string("fix_ip_address"), add_string("1"));
-    parser.skip('/');
-  }
-
-  if (parser.try_skip("#secret")) {
-    args.emplace_back(add_string("secret_token"), add_string(parser.read_till('/')));
-    parser.skip('/');
-  }
-
-  if (parser.try_skip("#allow")) {
-    args.emplace_back(add_string("allowed_updates"), add_string(parser.read_till('/')));
-    parser.skip('/');
-  }
-
-  args.emplace_back(add_string("url"), add_string(parser.read_all()));
+  args.emplace_back(add_string("webhook_config"), add_string(webhook_info));
 
   const auto method = add_string("setwebhook");
   auto query = td::make_unique<Query>(std::move(containers), token, is_test_dc, method, std::move(args),
                                       td::vector<std::pair<td::MutableSlice, td::MutableSlice>>(),
                                       td::vector<td::HttpFile>(), std::move(shared_data), td::IPAddress(), true);
-  return PromisedQueryPtr(query.release(), PromiseDeleter(td::Promise<td::unique_ptr<Query>>()));
+  return PromisedQueryPtr(query.release(), PromiseDeleter(std::move(promise)));
 }
 
 void ClientManager::dump_statistics() {
@@ -545,21 +1106,15 @@ void ClientManager::timeout_expired() {
   send_closure(watchdog_id_, &Watchdog::kick);
   set_timeout_in(WATCHDOG_TIMEOUT / 10);
 
-  double now = td::Time::now();
-  if (now > next_tqueue_gc_time_) {
-    auto unix_time = parameters_->shared_data_->get_unix_time(now);
-    LOG(INFO) << "Run TQueue GC at " << unix_time;
-    td::int64 deleted_events;
-    bool is_finished;
-    std::tie(deleted_events, is_finished) = parameters_->shared_data_->tqueue_->run_gc(unix_time);
-    LOG(INFO) << "TQueue GC deleted " << deleted_events << " events";
-    next_tqueue_gc_time_ = td::Time::now() + (is_finished ? 60.0 : 1.0);
-
-    tqueue_deleted_events_ += deleted_events;
-    if (tqueue_deleted_events_ > last_tqueue_deleted_events_ + 10000) {
-      LOG(WARNING) << "TQueue GC already deleted " << tqueue_deleted_events_ << " events since the start";
-      last_tqueue_deleted_events_ = tqueue_deleted_events_;
-    }
+  // GC is run in short passes once in a timeout, so queries received in between aren't delayed by the whole GC
+  auto now = td::Time::now();
+  if (now > next_tqueue_full_gc_time_) {
+    run_tqueue_full_gc();
+  } else if (now > next_tqueue_gc_time_) {
+    run_tqueue_gc();
+  }
+  if (new_bot_stat_snapshot_ != nullptr && !close_flag_) {
+    run_bot_stat_snapshot_pass();
   }
 
   if (!is_global_flood_control_enabled_ && !parameters_->local_mode_) {
@@ -569,12 +1124,95 @@ void ClientManager::timeout_expired() {
   }
 }
 
+void ClientManager::add_tqueue_id(td::int64 tqueue_id) {
+  if (known_tqueue_ids_.insert(tqueue_id).second) {
+    tqueue_ids_.push_back(tqueue_id);
+  }
+}
+
+void ClientManager::run_tqueue_gc() {
+  if (close_flag_) {
+    return;
+  }
+
+  auto start_time = td::Time::now();
+  auto max_finish_time = start_time + TQUEUE_GC_MAX_PASS_DURATION;
+  auto unix_time = parameters_->shared_data_->get_unix_time(start_time);
+  LOG(INFO) << "Run TQueue GC at " << unix_time << " from queue " << tqueue_gc_next_queue_index_;
+  auto &tqueue = *parameters_->shared_data_->tqueue_;
+  td::int64 deleted_events = 0;
+  td::TQueue::Event event;
+  while (tqueue_gc_next_queue_index_ < tqueue_ids_.size()) {
+    auto tqueue_id = tqueue_ids_[tqueue_gc_next_queue_index_++];
+    auto size = tqueue.get_size(tqueue_id);
+    if (size == 0) {
+      continue;
+    }
+
+    // TQueue deletes all expired events found before the first non-expired event; updates are added with the same
+    // lifetime, so almost all expired events are found this way, and the rest is deleted by the full GC
+    td::MutableSpan<td::TQueue::Event> events(&event, 1);
+    auto r_size = tqueue.get(tqueue_id, tqueue.get_head(tqueue_id), false, unix_time, events);
+    if (r_size.is_ok() && r_size.ok() < size) {
+      deleted_events += static_cast<td::int64>(size - r_size.ok());
+    }
+    if (td::Time::now() >= max_finish_time) {
+      break;
+    }
+  }
+  bool is_finished = tqueue_gc_next_queue_index_ == tqueue_ids_.size();
+  auto end_time = td::Time::now();
+  on_tqueue_gc_pass(deleted_events, end_time - start_time);
+
+  if (is_finished) {
+    tqueue_gc_next_queue_index_ = 0;
+    next_tqueue_gc_time_ = end_time + TQUEUE_GC_PERIOD;
+  }
+}
+
+void ClientManager::run_tqueue_full_gc() {
+  if (close_flag_) {
+    return;
+  }
+
+  // TQueue::run_gc uses the expiration-ordered index of all queues, including queues of bots without Client,
+  // but stops only after about 50 ms, so it is run rarely and only one pass per timeout
+  auto start_time = td::Time::now();
+  auto unix_time = parameters_->shared_data_->get_unix_time(start_time);
+  LOG(INFO) << "Run full TQueue GC at " << unix_time;
+  td::int64 deleted_events;
+  bool is_finished;
+  std::tie(deleted_events, is_finished) = parameters_->shared_data_->tqueue_->run_gc(unix_time);
+  auto end_time = td::Time::now();
+  on_tqueue_gc_pass(deleted_events, end_time - start_time);
+
+  if (is_finished) {
+    next_tqueue_full_gc_time_ = end_time + TQUEUE_FULL_GC_PERIOD;
+  }
+}
+
+void ClientManager::on_tqueue_gc_pass(td::int64 deleted_events, double pass_duration) {
+  LOG(INFO) << "TQueue GC deleted " << deleted_events << " events in " << pass_duration;
+  tqueue_gc_max_pass_duration_ = td::max(tqueue_gc_max_pass_duration_, pass_duration);
+
+  tqueue_deleted_events_ += deleted_events;
+  if (tqueue_deleted_events_ > last_tqueue_deleted_events_ + 10000) {
+    LOG(WARNING) << "TQueue GC already deleted " << tqueue_deleted_events_ << " events since the start";
+    last_tqueue_deleted_events_ = tqueue_deleted_events_;
+  }
+}
+
 void ClientManager::hangup_shared() {
   auto id = get_link_token();
   auto *info = clients_.get(id);
   CHECK(info != nullptr);
   info->client_.release();
+  info->stat_.on_remove();
   token_to_id_.erase(info->token_);
+  auto tqueue_it = tqueue_id_to_id_.find(info->tqueue_id_);
+  if (tqueue_it != tqueue_id_to_id_.end() && tqueue_it->second == id) {
+    tqueue_id_to_id_.erase(tqueue_it);
+  }
   clients_.erase(id);
 
   if (close_flag_ && clients_.empty()) {
@@ -17,6 +17,7 @@
 #include "td/utils/common.h"
 #include "td/utils/Container.h"
 #include "td/utils/FlatHashMap.h"
+#include "td/utils/FlatHashSet.h"
 #include "td/utils/FloodControlFast.h"
 #include "td/utils/Promise.h"
 #include "td/utils/Slice.h"
@@ -48,6 +49,11 @@ class ClientManager final : public td::Actor {
 
   void get_stats(td::Promise<td::BufferSlice> promise, td::vector<std::pair<td::string, td::string>> args);
 
+  void get_metrics(td::Promise<td::BufferSlice> promise, td::vector<std::pair<td::string, td::string>> args);
+
+  void get_json_stats(td::Promise<td::BufferSlice> promise, td::string path,
+                      td::vector<std::pair<td::string, td::string>> args);
+
   void close(td::Promise<td::Unit> &&promise);
 
  private:
@@ -65,6 +71,7 @@ class ClientManager final : public td::Actor {
   TokenRange token_range_;
 
   td::FlatHashMap<td::string, td::uint64> token_to_id_;
+  td::FlatHashMap<td::int64, td::uint64> tqueue_id_to_id_;  // the last created client for each queue
   td::FlatHashMap<td::string, td::FloodControlFast> flood_controls_;
   td::FloodControlFast global_flood_control_;
   bool is_global_flood_control_enabled_ = false;
@@ -73,17 +80,34 @@ class ClientManager final : public td::Actor {
   bool close_flag_ = false;
   td::vector<td::Promise<td::Unit>> close_promises_;
 
+  td::vector<td::string> pending_webhook_restores_;  // in reverse order of restore
+  std::size_t active_webhook_restore_count_ = 0;
+
   td::ActorOwn<Watchdog> watchdog_id_;
   double next_tqueue_gc_time_ = 0.0;
+  double next_tqueue_full_gc_time_ = 0.0;
+  td::vector<td::int64> tqueue_ids_;  // identifiers of all used queues in order of their first use
+  td::FlatHashSet<td::int64> known_tqueue_ids_;
+  std::size_t tqueue_gc_next_queue_index_ = 0;
+  double tqueue_gc_max_pass_duration_ = 0.0;
   td::int64 tqueue_deleted_events_ = 0;
   td::int64 last_tqueue_deleted_events_ = 0;
 
   static constexpr double WATCHDOG_TIMEOUT = 0.25;
+  static constexpr double TQUEUE_GC_PERIOD = 60.0;
+  static constexpr double TQUEUE_GC_MAX_PASS_DURATION = 0.001;
+  static constexpr double TQUEUE_FULL_GC_PERIOD = 600.0;
+  static constexpr std::size_t MAX_ACTIVE_WEBHOOK_RESTORES = 50;
 
   static td::int64 get_tqueue_id(td::int64 user_id, bool is_test_dc);
 
   static PromisedQueryPtr get_webhook_restore_query(td::Slice token, td::Slice webhook_info,
-                                                    std::shared_ptr<SharedData> shared_data);
+                                                    std::shared_ptr<SharedData> shared_data,
+                                                    td::Promise<td::unique_ptr<Query>> promise);
+
+  void restore_webhooks();
+
+  void on_webhook_restored();
 
   struct TopClients {
     td::int32 active_count = 0;
@@ -91,9 +115,55 @@ class ClientManager final : public td::Actor {
   };
   TopClients get_top_clients(std::size_t max_count, td::Slice token_filter);
 
+  // returns identifiers of clients, which had events recently, in arbitrary order
+  const td::vector<td::uint64> &get_recently_active_client_ids(double now);
+
+  static constexpr std::size_t DEFAULT_METRICS_BOT_COUNT = 100;
+  static constexpr std::size_t MAX_METRICS_BOT_COUNT = 10000;
+
+  // clients, which aren't recently active, are ranked only by their all-time score, so it is enough to keep
+  // the clients with the best score at the time they stopped being recently active
+  static constexpr std::size_t MAX_IDLE_TOP_CLIENT_COUNT = MAX_METRICS_BOT_COUNT;
+  td::vector<std::pair<double, td::uint64>> idle_top_clients_;  // min-heap by score
+  td::FlatHashSet<td::uint64> idle_top_client_ids_;
+
+  void add_idle_top_client(td::uint64 id, double score);
+
+  void remove_deleted_idle_top_clients();
+
+  // the snapshot of all bots is built in short passes over all queues like the TQueue GC
+  static constexpr double BOT_STAT_SNAPSHOT_UPDATE_PERIOD = 5.0;
+  static constexpr double BOT_STAT_SNAPSHOT_MAX_PASS_DURATION = 0.001;
+  static constexpr std::size_t DEFAULT_JSON_STATS_BOT_COUNT = 100;
+  static constexpr std::size_t MAX_JSON_STATS_BOT_COUNT = 1000;
+  std::shared_ptr<const td::vector<BotStatSnapshot>> bot_stat_snapshot_;
+  double bot_stat_snapshot_time_ = 0.0;
+  td::unique_ptr<td::vector<BotStatSnapshot>> new_bot_stat_snapshot_;
+  std::size_t bot_stat_snapshot_next_queue_index_ = 0;
+  td::vector<std::pair<td::vector<std::pair<td::string, td::string>>, td::Promise<td::BufferSlice>>>
+      pending_bots_json_stats_queries_;
+
+  BotStatSnapshot get_bot_stat(ClientInfo *client_info, double now);
+
+  void run_bot_stat_snapshot_pass();
+
+  void send_bots_json_stats(td::vector<std::pair<td::string, td::string>> args, td::Promise<td::BufferSlice> promise);
+
+  td::BufferSlice get_bot_json_stats(td::Slice bot_id, double now);
+
+  static td::BufferSlice get_bots_json_stats(const td::vector<BotStatSnapshot> &snapshot, double snapshot_time,
+                                             const td::vector<std::pair<td::string, td::string>> &args);
+
   void start_up() final;
   void raw_event(const td::Event::Raw &event) final;
   void timeout_expired() final;
+  void add_tqueue_id(td::int64 tqueue_id);
+
+  void run_tqueue_gc();
+
+  void run_tqueue_full_gc();
+
+  void on_tqueue_gc_pass(td::int64 deleted_events, double pass_duration);
   void hangup_shared() final;
   void close_db();
   void finish_close();
@@ -27,6 +27,8 @@ class NetQueryStats;
 
 namespace telegram_bot_api {
 
+class WebhookConnectionPool;
+
 struct SharedData {
   std::atomic<td::uint64> query_count_{0};
   std::atomic<size_t> query_list_size_{0};
@@ -39,9 +41,6 @@ struct SharedData {
 
   double unix_time_difference_{-1e100};
 
-  static constexpr size_t TQUEUE_EVENT_BUFFER_SIZE = 1000;
-  td::TQueue::Event event_buffer_[TQUEUE_EVENT_BUFFER_SIZE];
-
   td::int32 get_unix_time(double now) const {
     auto result = unix_time_difference_ + now;
     if (result <= 0) {
@@ -73,9 +72,15 @@ struct SharedData {
     return 6;
   }
 
-  static td::int32 get_slow_outgoing_http_scheduler_id() {
-    // the thread for slow outgoing HTTP connections
-    return 7;
+  static constexpr td::int32 MAX_SLOW_OUTGOING_HTTP_THREAD_COUNT = 32;
+
+  static td::int32 get_slow_outgoing_http_scheduler_id(td::int32 thread_index) {
+    // the threads for slow outgoing HTTP connections; additional threads are placed after all other threads
+    CHECK(0 <= thread_index && thread_index < MAX_SLOW_OUTGOING_HTTP_THREAD_COUNT);
+    if (thread_index == 0) {
+      return 7;
+    }
+    return 11 + thread_index;
   }
 
   static td::int32 get_dns_resolver_scheduler_id() {
@@ -98,8 +103,8 @@ struct SharedData {
     return 11;
   }
 
-  static td::int32 get_thread_count() {
-    return 12;
+  static td::int32 get_thread_count(td::int32 slow_outgoing_http_thread_count) {
+    return 11 + slow_outgoing_http_thread_count;
   }
 };
 
@@ -116,10 +121,17 @@ struct ClientParameters {
 
   td::int32 default_max_webhook_connections_ = 0;
   td::IPAddress webhook_proxy_ip_address_;
+  td::int32 webhook_thread_count_ = 1;
+  td::int32 webhook_compression_threshold_ = 0;
+
+  td::int32 update_compression_threshold_ = 0;
+
+  td::int32 response_compression_threshold_ = 0;
 
   double start_time_ = 0;
 
   td::ActorId<td::GetHostByNameActor> get_host_by_name_actor_id_;
+  td::ActorId<WebhookConnectionPool> webhook_connection_pool_id_;
 
   std::shared_ptr<SharedData> shared_data_;
 
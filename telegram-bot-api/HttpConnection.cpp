@@ -6,23 +6,84 @@
 //
 #include "telegram-bot-api/HttpConnection.h"
 
+#include "telegram-bot-api/ClientParameters.h"
 #include "telegram-bot-api/Query.h"
 
 #include "td/net/HttpHeaderCreator.h"
 
 #include "td/utils/common.h"
+#include "td/utils/config.h"
+#include "td/utils/Gzip.h"
 #include "td/utils/JsonBuilder.h"
 #include "td/utils/logging.h"
+#include "td/utils/misc.h"
 #include "td/utils/Parser.h"
 #include "td/utils/Promise.h"
 #include "td/utils/SliceBuilder.h"
 
+#include <algorithm>
+
 namespace telegram_bot_api {
 
+static bool is_gzip_accepted(td::Slice accept_encoding) {
+  for (auto coding : td::full_split(accept_encoding, ',')) {
+    auto parameters = td::full_split(coding, ';');
+    auto name = td::to_lower(td::trim(parameters[0]));
+    if (name != "gzip" && name != "x-gzip") {
+      continue;
+    }
+    bool is_rejected = false;
+    for (size_t i = 1; i < parameters.size(); i++) {
+      auto parameter = td::trim(parameters[i]);
+      if (parameter.size() >= 2 && (parameter[0] == 'q' || parameter[0] == 'Q') && parameter[1] == '=') {
+        is_rejected = td::to_double(parameter.substr(2)) <= 0.0;
+      }
+    }
+    if (!is_rejected) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static td::Result<td::string> create_response_header(int http_status_code, std::size_t content_size, int retry_after,
+                                                      bool is_gzipped) {
+  td::HttpHeaderCreator hc;
+  hc.init_status_line(http_status_code);
+  hc.set_keep_alive();
+  hc.set_content_type("application/json");
+  if (retry_after > 0) {
+    hc.add_header("Retry-After", PSLICE() << retry_after);
+  }
+  if (is_gzipped) {
+    hc.add_header("Content-Encoding", "gzip");
+    hc.add_header("Vary", "Accept-Encoding");
+  }
+  hc.set_content_size(content_size);
+  TRY_RESULT(header, hc.finish());
+  return header.str();
+}
+
+static void write_response(td::ActorId<td::HttpInboundConnection> connection_id, int http_status_code,
+                           td::BufferSlice &&content, int retry_after, bool is_gzipped) {
+  auto r_header = create_response_header(http_status_code, content.size(), retry_after, is_gzipped);
+  if (r_header.is_error()) {
+    LOG(ERROR) << "Bad response headers";
+    send_closure(connection_id, &td::HttpInboundConnection::write_error, r_header.move_as_error());
+    return;
+  }
+  LOG(DEBUG) << "Response headers: " << r_header.ok();
+
+  send_closure(connection_id, &td::HttpInboundConnection::write_next_noflush, td::BufferSlice(r_header.ok()));
+  send_closure(connection_id, &td::HttpInboundConnection::write_next_noflush, std::move(content));
+  send_closure(connection_id, &td::HttpInboundConnection::write_ok);
+}
+
 void HttpConnection::handle(td::unique_ptr<td::HttpQuery> http_query,
                             td::ActorOwn<td::HttpInboundConnection> connection) {
   CHECK(connection_.empty());
   connection_ = std::move(connection);
+  is_gzip_accepted_ = false;
 
   LOG(DEBUG) << "Handle " << *http_query;
   td::Parser url_path_parser(http_query->url_path_);
@@ -48,6 +109,8 @@ void HttpConnection::handle(td::unique_ptr<td::HttpQuery> http_query,
   auto query = td::make_unique<Query>(std::move(http_query->container_), token, is_test_dc, method,
                                       std::move(http_query->args_), std::move(http_query->headers_),
                                       std::move(http_query->files_), shared_data_, http_query->peer_address_, false);
+  query->set_http_connection_id(actor_id(this));
+  is_gzip_accepted_ = response_compression_threshold_ > 0 && is_gzip_accepted(query->get_header("accept-encoding"));
 
   auto promise = td::PromiseCreator::lambda([actor_id = actor_id(this)](td::Result<td::unique_ptr<Query>> r_query) {
     send_closure(actor_id, &HttpConnection::on_query_finished, std::move(r_query));
@@ -60,33 +123,120 @@ void HttpConnection::on_query_finished(td::Result<td::unique_ptr<Query>> r_query
   LOG_CHECK(r_query.is_ok()) << r_query.error();
 
   auto query = r_query.move_as_ok();
+  if (query->is_stream()) {
+    return start_stream();
+  }
   send_response(query->http_status_code(), std::move(query->answer()), query->retry_after());
 }
 
-void HttpConnection::send_response(int http_status_code, td::BufferSlice &&content, int retry_after) {
+void HttpConnection::set_stream_close_promise(td::Promise<td::Unit> promise) {
+  stream_close_promise_ = std::move(promise);
+}
+
+void HttpConnection::start_stream() {
+  CHECK(!is_stream_);
   td::HttpHeaderCreator hc;
-  hc.init_status_line(http_status_code);
+  hc.init_status_line(200);
   hc.set_keep_alive();
-  hc.set_content_type("application/json");
-  if (retry_after > 0) {
-    hc.add_header("Retry-After", PSLICE() << retry_after);
-  }
-  hc.set_content_size(content.size());
-
+  hc.set_content_type("application/x-ndjson");
+  hc.add_header("Transfer-Encoding", "chunked");
+  hc.add_header("Cache-Control", "no-cache");
   auto r_header = hc.finish();
-  LOG(DEBUG) << "Response headers: " << r_header.ok();
   if (r_header.is_error()) {
-    LOG(ERROR) << "Bad response headers";
+    LOG(ERROR) << "Bad stream headers";
+    stream_close_promise_.set_error(td::Status::Error("Bad stream headers"));
     send_closure(std::move(connection_), &td::HttpInboundConnection::write_error, r_header.move_as_error());
     return;
   }
-  LOG(DEBUG) << "Send result: " << content;
+  LOG(DEBUG) << "Stream headers: " << r_header.ok();
+
+  is_stream_ = true;
+  send_closure(connection_, &td::HttpInboundConnection::write_next, td::BufferSlice(r_header.ok()));
+  set_timeout_in(STREAM_HEARTBEAT_INTERVAL);
+}
+
+void HttpConnection::write_stream_chunk(td::Slice data) {
+  CHECK(is_stream_);
+  // chunked transfer coding: hexadecimal size of the chunk, CRLF, the chunk and CRLF
+  td::string size_str;
+  auto size = data.size();
+  do {
+    size_str += "0123456789abcdef"[size % 16];
+    size /= 16;
+  } while (size > 0);
+  std::reverse(size_str.begin(), size_str.end());
+
+  td::BufferSlice chunk(size_str.size() + data.size() + 4);
+  td::MutableSlice chunk_data = chunk.as_mutable_slice();
+  chunk_data.copy_from(size_str);
+  chunk_data.remove_prefix(size_str.size());
+  chunk_data.copy_from("\r\n");
+  chunk_data.remove_prefix(2);
+  chunk_data.copy_from(data);
+  chunk_data.remove_prefix(data.size());
+  chunk_data.copy_from("\r\n");
+
+  send_closure(connection_, &td::HttpInboundConnection::write_next, std::move(chunk));
+  set_timeout_in(STREAM_HEARTBEAT_INTERVAL);
+}
+
+void HttpConnection::send_stream_data(td::BufferSlice data) {
+  if (!is_stream_ || data.empty()) {
+    return;
+  }
+  LOG(DEBUG) << "Send stream data: " << data;
+  write_stream_chunk(data.as_slice());
+}
 
-  send_closure(connection_, &td::HttpInboundConnection::write_next_noflush, td::BufferSlice(r_header.ok()));
-  send_closure(connection_, &td::HttpInboundConnection::write_next_noflush, std::move(content));
+void HttpConnection::timeout_expired() {
+  if (is_stream_) {
+    // an empty line is ignored by receivers, but allows to find out closed connections
+    write_stream_chunk("\n");
+  }
+}
+
+void HttpConnection::finish_stream() {
+  if (!is_stream_) {
+    return;
+  }
+  is_stream_ = false;
+  cancel_timeout();
+  if (stream_close_promise_) {
+    stream_close_promise_.set_value(td::Unit());
+  }
+
+  send_closure(connection_, &td::HttpInboundConnection::write_next_noflush, td::BufferSlice("0\r\n\r\n"));
   send_closure(std::move(connection_), &td::HttpInboundConnection::write_ok);
 }
 
+void HttpConnection::send_response(int http_status_code, td::BufferSlice &&content, int retry_after) {
+  LOG(DEBUG) << "Send result: " << content;
+  bool need_compression = false;
+#if TD_HAVE_ZLIB
+  need_compression = is_gzip_accepted_ && content.size() >= static_cast<std::size_t>(response_compression_threshold_);
+#endif
+  auto connection_id = connection_.release();
+  if (need_compression) {
+    // compress the response on the connection's thread to keep the client thread responsive
+    td::Scheduler::instance()->run_on_scheduler(
+        SharedData::get_slow_incoming_http_scheduler_id(),
+        [connection_id, http_status_code, content = std::move(content), retry_after](td::Unit) mutable {
+          td::BufferSlice compressed_content;
+#if TD_HAVE_ZLIB
+          compressed_content = td::gzencode(content.as_slice(), 0.9);
+#endif
+          bool is_gzipped = !compressed_content.empty();
+          if (is_gzipped) {
+            content = std::move(compressed_content);
+          }
+          write_response(connection_id, http_status_code, std::move(content), retry_after, is_gzipped);
+        });
+    return;
+  }
+
+  write_response(connection_id, http_status_code, std::move(content), retry_after, false);
+}
+
 void HttpConnection::send_http_error(int http_status_code, td::Slice description) {
   send_response(http_status_code, td::json_encode<td::BufferSlice>(JsonQueryError(http_status_code, description)), 0);
 }
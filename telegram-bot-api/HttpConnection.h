@@ -15,6 +15,8 @@
 #include "td/actor/actor.h"
 
 #include "td/utils/buffer.h"
+#include "td/utils/common.h"
+#include "td/utils/Promise.h"
 #include "td/utils/Slice.h"
 #include "td/utils/Status.h"
 
@@ -26,22 +28,45 @@ struct SharedData;
 
 class HttpConnection final : public td::HttpInboundConnection::Callback {
  public:
-  HttpConnection(td::ActorId<ClientManager> client_manager, std::shared_ptr<SharedData> shared_data)
-      : client_manager_(client_manager), shared_data_(std::move(shared_data)) {
+  HttpConnection(td::ActorId<ClientManager> client_manager, std::shared_ptr<SharedData> shared_data,
+                 td::int32 response_compression_threshold)
+      : client_manager_(client_manager)
+      , shared_data_(std::move(shared_data))
+      , response_compression_threshold_(response_compression_threshold) {
   }
 
   void handle(td::unique_ptr<td::HttpQuery> http_query, td::ActorOwn<td::HttpInboundConnection> connection) final;
 
+  // the promise is fulfilled or failed when the streamed response is finished or the connection is closed
+  void set_stream_close_promise(td::Promise<td::Unit> promise);
+
+  void send_stream_data(td::BufferSlice data);
+
+  void finish_stream();
+
  private:
+  static constexpr double STREAM_HEARTBEAT_INTERVAL = 15.0;
+
   td::ActorId<ClientManager> client_manager_;
   td::ActorOwn<td::HttpInboundConnection> connection_;
   std::shared_ptr<SharedData> shared_data_;
+  td::int32 response_compression_threshold_ = 0;
+  bool is_gzip_accepted_ = false;
+
+  bool is_stream_ = false;
+  td::Promise<td::Unit> stream_close_promise_;
 
   void hangup() final {
     connection_.release();
     stop();
   }
 
+  void timeout_expired() final;
+
+  void start_stream();
+
+  void write_stream_chunk(td::Slice data);
+
   void on_query_finished(td::Result<td::unique_ptr<Query>> r_query);
 
   void send_response(int http_status_code, td::BufferSlice &&content, int retry_after);
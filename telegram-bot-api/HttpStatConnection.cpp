@@ -6,10 +6,19 @@
 //
 #include "telegram-bot-api/HttpStatConnection.h"
 
+#include "telegram-bot-api/ClientParameters.h"
+#include "telegram-bot-api/Metrics.h"
+#include "telegram-bot-api/Profiler.h"
+
 #include "td/net/HttpHeaderCreator.h"
 
+#include "td/utils/buffer.h"
 #include "td/utils/common.h"
+#include "td/utils/misc.h"
 #include "td/utils/Promise.h"
+#include "td/utils/Slice.h"
+#include "td/utils/SliceBuilder.h"
+#include "td/utils/Status.h"
 
 namespace telegram_bot_api {
 
@@ -18,13 +27,57 @@ void HttpStatConnection::handle(td::unique_ptr<td::HttpQuery> http_query,
   CHECK(connection_.empty());
   connection_ = std::move(connection);
 
-  auto promise = td::PromiseCreator::lambda([actor_id = actor_id(this)](td::Result<td::BufferSlice> result) {
-    send_closure(actor_id, &HttpStatConnection::on_result, std::move(result));
-  });
-  send_closure(client_manager_, &ClientManager::get_stats, std::move(promise), http_query->get_args());
+  td::Slice url_path = http_query->url_path_;
+  td::Slice content_type = "text/plain";
+  if (url_path == "/metrics") {
+    content_type = OpenMetricsBuilder::CONTENT_TYPE;
+  } else if (td::begins_with(url_path, "/json/")) {
+    content_type = "application/json";
+  }
+  auto promise =
+      td::PromiseCreator::lambda([actor_id = actor_id(this), content_type](td::Result<td::BufferSlice> result) {
+        send_closure(actor_id, &HttpStatConnection::on_result, std::move(result), content_type);
+      });
+  if (url_path == "/metrics") {
+    send_closure(client_manager_, &ClientManager::get_metrics, std::move(promise), http_query->get_args());
+  } else if (td::begins_with(url_path, "/json/")) {
+    send_closure(client_manager_, &ClientManager::get_json_stats, std::move(promise), url_path.str(),
+                 http_query->get_args());
+  } else if (url_path == "/profiler/start") {
+    auto frequency = Profiler::DEFAULT_FREQUENCY;
+    auto frequency_str = http_query->get_arg("frequency");
+    td::Status status;
+    if (!frequency_str.empty()) {
+      auto r_frequency = td::to_integer_safe<td::int32>(frequency_str);
+      if (r_frequency.is_error()) {
+        status = td::Status::Error(PSLICE() << "Invalid profiling frequency specified: "
+                                            << r_frequency.error().message());
+      } else {
+        frequency = r_frequency.ok();
+      }
+    }
+    if (status.is_ok()) {
+      status = Profiler::start(frequency);
+    }
+    promise.set_value(td::BufferSlice(status.is_ok() ? td::Slice("Profiler started\n") : status.message()));
+  } else if (url_path == "/profiler/stop") {
+    Profiler::stop();
+    promise.set_value(td::BufferSlice("Profiler stopped\n"));
+  } else if (url_path == "/profiler/stacks") {
+    // symbolization of stacks is slow, so it is done on the statistics thread
+    bool need_reset = td::to_integer<td::int32>(http_query->get_arg("reset")) != 0;
+    td::Scheduler::instance()->run_on_scheduler(SharedData::get_statistics_thread_id(),
+                                                [need_reset, promise = std::move(promise)](td::Unit) mutable {
+                                                  Profiler::flush();
+                                                  promise.set_value(
+                                                      td::BufferSlice(Profiler::get_folded_stacks(need_reset)));
+                                                });
+  } else {
+    send_closure(client_manager_, &ClientManager::get_stats, std::move(promise), http_query->get_args());
+  }
 }
 
-void HttpStatConnection::on_result(td::Result<td::BufferSlice> result) {
+void HttpStatConnection::on_result(td::Result<td::BufferSlice> result, td::Slice content_type) {
   if (result.is_error()) {
     send_closure(connection_.release(), &td::HttpInboundConnection::write_error,
                  td::Status::Error(500, "Internal Server Error: closing"));
@@ -35,7 +88,7 @@ void HttpStatConnection::on_result(td::Result<td::BufferSlice> result) {
   td::HttpHeaderCreator hc;
   hc.init_status_line(200);
   hc.set_keep_alive();
-  hc.set_content_type("text/plain");
+  hc.set_content_type(content_type);
   hc.set_content_size(content.size());
 
   auto r_header = hc.finish();
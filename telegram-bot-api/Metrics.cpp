@@ -0,0 +1,73 @@
+//
+// Copyright Aliaksei Levin (levlam@telegram.org), Arseny Smirnov (arseny30@gmail.com) 2014-2025
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#include "telegram-bot-api/Metrics.h"
+
+#include <utility>
+
+namespace telegram_bot_api {
+
+td::string OpenMetricsBuilder::label(td::Slice name, td::Slice value) {
+  td::string result = name.str();
+  result += "=\"";
+  for (auto c : value) {
+    switch (c) {
+      case '\\':
+        result += "\\\\";
+        break;
+      case '"':
+        result += "\\\"";
+        break;
+      case '\n':
+        result += "\\n";
+        break;
+      default:
+        result += c;
+        break;
+    }
+  }
+  result += '"';
+  return result;
+}
+
+void OpenMetricsBuilder::add_family(td::Slice name, td::Slice type, td::Slice help) {
+  result_ += PSLICE() << "# TYPE " << name << ' ' << type << '\n';
+  result_ += PSLICE() << "# HELP " << name << ' ' << help << '\n';
+}
+
+void OpenMetricsBuilder::add_sample_value(td::Slice name, td::Slice labels, td::Slice value) {
+  result_.append(name.begin(), name.size());
+  if (!labels.empty()) {
+    result_ += '{';
+    result_.append(labels.begin(), labels.size());
+    result_ += '}';
+  }
+  result_ += ' ';
+  result_.append(value.begin(), value.size());
+  result_ += '\n';
+}
+
+void OpenMetricsBuilder::add_histogram(td::Slice name, td::Slice labels, const Histogram &histogram, double scale) {
+  td::string bucket_labels = labels.str();
+  if (!bucket_labels.empty()) {
+    bucket_labels += ',';
+  }
+  auto bucket_name = PSTRING() << name << "_bucket";
+  for (auto &bucket : histogram.get_buckets()) {
+    add_sample(bucket_name, PSLICE() << bucket_labels << "le=\"" << static_cast<double>(bucket.first) * scale << '"',
+               bucket.second);
+  }
+  add_sample(bucket_name, PSLICE() << bucket_labels << "le=\"+Inf\"", histogram.get_count());
+  add_sample(PSLICE() << name << "_count", labels, histogram.get_count());
+  add_sample(PSLICE() << name << "_sum", labels, static_cast<double>(histogram.get_sum()) * scale);
+}
+
+td::string OpenMetricsBuilder::finish() {
+  result_ += "# EOF\n";
+  return std::move(result_);
+}
+
+}  // namespace telegram_bot_api
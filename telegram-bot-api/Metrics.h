@@ -0,0 +1,45 @@
+//
+// Copyright Aliaksei Levin (levlam@telegram.org), Arseny Smirnov (arseny30@gmail.com) 2014-2025
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#pragma once
+
+#include "telegram-bot-api/Stats.h"
+
+#include "td/utils/common.h"
+#include "td/utils/Slice.h"
+#include "td/utils/SliceBuilder.h"
+
+namespace telegram_bot_api {
+
+// builds text exposition of metrics in OpenMetrics format
+class OpenMetricsBuilder {
+ public:
+  static constexpr const char *CONTENT_TYPE = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+
+  // returns the label in the form name="value"
+  static td::string label(td::Slice name, td::Slice value);
+
+  // all samples of a metric family must be added right after the family
+  void add_family(td::Slice name, td::Slice type, td::Slice help);
+
+  // labels are comma-separated results of the function label()
+  template <class T>
+  void add_sample(td::Slice name, td::Slice labels, T value) {
+    add_sample_value(name, labels, PSLICE() << value);
+  }
+
+  // adds buckets, count and sum of the histogram; values of the histogram are multiplied by the scale
+  void add_histogram(td::Slice name, td::Slice labels, const Histogram &histogram, double scale);
+
+  td::string finish();
+
+ private:
+  td::string result_;
+
+  void add_sample_value(td::Slice name, td::Slice labels, td::Slice value);
+};
+
+}  // namespace telegram_bot_api
@@ -0,0 +1,278 @@
+//
+// Copyright Aliaksei Levin (levlam@telegram.org), Arseny Smirnov (arseny30@gmail.com) 2014-2025
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#include "telegram-bot-api/Profiler.h"
+
+#include "td/utils/logging.h"
+#include "td/utils/port/platform.h"
+#include "td/utils/SliceBuilder.h"
+
+#if TD_LINUX && defined(__GLIBC__)
+#define TELEGRAM_BOT_API_HAVE_PROFILER 1
+#endif
+
+#if TELEGRAM_BOT_API_HAVE_PROFILER
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <cxxabi.h>
+#include <execinfo.h>
+#include <sys/time.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <utility>
+
+namespace telegram_bot_api {
+
+#if TELEGRAM_BOT_API_HAVE_PROFILER
+
+namespace {
+
+constexpr int MAX_STACK_DEPTH = 64;
+constexpr int SKIPPED_FRAME_COUNT = 2;  // the signal handler and the signal trampoline
+constexpr std::size_t SAMPLE_BUFFER_SIZE = 1 << 14;
+
+enum SampleState : int { Free, Writing, Ready };
+
+struct Sample {
+  std::atomic<int> state{Free};
+  td::int32 scheduler_id = -1;
+  int depth = 0;
+  void *frames[MAX_STACK_DEPTH];
+};
+
+// a variable with the initial-exec TLS model is allocated with the thread and is safe to access in a signal handler
+thread_local td::int32 thread_scheduler_id __attribute__((tls_model("initial-exec"))) = -1;
+
+// the buffer is filled by the signal handler and is never deallocated, because a signal can come at any time
+Sample *sample_buffer = nullptr;
+std::atomic<bool> is_profiler_running{false};
+std::atomic<td::uint64> next_sample_position{0};
+std::atomic<td::uint64> dropped_sample_count{0};
+
+std::mutex profiler_mutex;
+// the scheduler of the thread and frames from the outermost to the innermost
+std::map<std::pair<td::int32, td::vector<void *>>, td::uint64> aggregated_stacks;
+
+void profiler_signal_handler(int sig) {
+  if (!is_profiler_running.load(std::memory_order_acquire)) {
+    return;
+  }
+  auto saved_errno = errno;
+  auto &sample = sample_buffer[next_sample_position.fetch_add(1, std::memory_order_relaxed) % SAMPLE_BUFFER_SIZE];
+  int expected_state = Free;
+  if (sample.state.compare_exchange_strong(expected_state, Writing, std::memory_order_acquire)) {
+    sample.scheduler_id = thread_scheduler_id;
+    sample.depth = backtrace(sample.frames, MAX_STACK_DEPTH);
+    sample.state.store(Ready, std::memory_order_release);
+  } else {
+    dropped_sample_count.fetch_add(1, std::memory_order_relaxed);
+  }
+  errno = saved_errno;
+}
+
+void flush_samples() {
+  if (sample_buffer == nullptr) {
+    return;
+  }
+  td::vector<void *> stack;
+  for (std::size_t i = 0; i < SAMPLE_BUFFER_SIZE; i++) {
+    auto &sample = sample_buffer[i];
+    if (sample.state.load(std::memory_order_acquire) != Ready) {
+      continue;
+    }
+    stack.clear();
+    for (int j = sample.depth - 1; j >= SKIPPED_FRAME_COUNT; j--) {
+      stack.push_back(sample.frames[j]);
+    }
+    sample.state.store(Free, std::memory_order_release);
+    if (!stack.empty()) {
+      aggregated_stacks[std::make_pair(sample.scheduler_id, stack)]++;
+    }
+  }
+}
+
+// returns name of the function for a string in the format "module(mangled_name+offset) [address]";
+// if the function has no exported name, returns "module+offset", which can be resolved with addr2line
+td::string get_function_name(const td::string &symbol) {
+  auto name_begin = symbol.find('(');
+  auto name_end = name_begin == td::string::npos ? td::string::npos : symbol.find_first_of("+)", name_begin);
+  td::string result;
+  if (name_end != td::string::npos && name_end > name_begin + 1) {
+    auto mangled_name = symbol.substr(name_begin + 1, name_end - name_begin - 1);
+    int status = 0;
+    char *demangled_name = abi::__cxa_demangle(mangled_name.c_str(), nullptr, nullptr, &status);
+    result = status == 0 && demangled_name != nullptr ? td::string(demangled_name) : mangled_name;
+    std::free(demangled_name);
+  } else {
+    result = symbol.substr(0, symbol.find_first_of("( "));
+    td::string offset;
+    if (name_end != td::string::npos && symbol[name_end] == '+') {
+      // the offset is relative to the load address of the module
+      auto offset_end = symbol.find(')', name_end);
+      if (offset_end != td::string::npos) {
+        offset = symbol.substr(name_end + 1, offset_end - name_end - 1);
+      }
+    } else {
+      // the module isn't relocated, for example, it is a non-PIE executable, so the absolute address is used
+      auto address_begin = symbol.find('[');
+      auto address_end = address_begin == td::string::npos ? td::string::npos : symbol.find(']', address_begin);
+      if (address_end != td::string::npos) {
+        offset = symbol.substr(address_begin + 1, address_end - address_begin - 1);
+      }
+    }
+    if (!offset.empty()) {
+      result += '+';
+      result += offset;
+    }
+  }
+  std::replace(result.begin(), result.end(), ';', ':');
+  return result;
+}
+
+}  // namespace
+
+td::Status Profiler::start(td::int32 frequency) {
+  if (frequency <= 0 || frequency > MAX_FREQUENCY) {
+    return td::Status::Error(PSLICE() << "Profiling frequency must be between 1 and " << MAX_FREQUENCY);
+  }
+
+  std::lock_guard<std::mutex> guard(profiler_mutex);
+  if (sample_buffer == nullptr) {
+    // the first call to backtrace loads libgcc, which isn't async-signal-safe, so it must be done beforehand
+    void *frames[1];
+    backtrace(frames, 1);
+
+    sample_buffer = new Sample[SAMPLE_BUFFER_SIZE];
+
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = profiler_signal_handler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, nullptr) != 0) {
+      return OS_ERROR("Failed to set SIGPROF handler");
+    }
+  }
+
+  is_profiler_running.store(true, std::memory_order_release);
+  struct itimerval timer;
+  // tv_usec must be less than 1000000
+  auto interval = 1000000 / frequency;
+  timer.it_interval.tv_sec = interval / 1000000;
+  timer.it_interval.tv_usec = interval % 1000000;
+  timer.it_value = timer.it_interval;
+  if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+    is_profiler_running.store(false, std::memory_order_relaxed);
+    return OS_ERROR("Failed to start profiling timer");
+  }
+  LOG(WARNING) << "Start profiler with frequency " << frequency;
+  return td::Status::OK();
+}
+
+void Profiler::stop() {
+  std::lock_guard<std::mutex> guard(profiler_mutex);
+  if (!is_profiler_running.load(std::memory_order_relaxed)) {
+    return;
+  }
+  struct itimerval timer;
+  std::memset(&timer, 0, sizeof(timer));
+  if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+    LOG(ERROR) << "Failed to stop profiling timer: " << OS_ERROR("setitimer failed");
+  }
+  is_profiler_running.store(false, std::memory_order_relaxed);
+  LOG(WARNING) << "Stop profiler";
+}
+
+bool Profiler::is_running() {
+  return is_profiler_running.load(std::memory_order_relaxed);
+}
+
+void Profiler::set_thread_scheduler_id(td::int32 scheduler_id) {
+  thread_scheduler_id = scheduler_id;
+}
+
+void Profiler::flush() {
+  std::lock_guard<std::mutex> guard(profiler_mutex);
+  flush_samples();
+}
+
+td::string Profiler::get_folded_stacks(bool need_reset) {
+  std::lock_guard<std::mutex> guard(profiler_mutex);
+  flush_samples();
+
+  td::vector<void *> addresses;
+  for (auto &it : aggregated_stacks) {
+    addresses.insert(addresses.end(), it.first.second.begin(), it.first.second.end());
+  }
+  std::sort(addresses.begin(), addresses.end());
+  addresses.erase(std::unique(addresses.begin(), addresses.end()), addresses.end());
+
+  std::map<void *, td::string> function_names;
+  if (!addresses.empty()) {
+    char **symbols = backtrace_symbols(addresses.data(), static_cast<int>(addresses.size()));
+    for (std::size_t i = 0; i < addresses.size(); i++) {
+      function_names[addresses[i]] =
+          symbols == nullptr ? td::string(PSLICE() << addresses[i]) : get_function_name(td::string(symbols[i]));
+    }
+    std::free(symbols);
+  }
+
+  td::string result;
+  for (auto &it : aggregated_stacks) {
+    if (it.first.first >= 0) {
+      result += PSLICE() << "scheduler_" << it.first.first;
+    } else {
+      result += "other_thread";
+    }
+    for (auto *address : it.first.second) {
+      result += ';';
+      result += function_names[address];
+    }
+    result += PSLICE() << ' ' << it.second << '\n';
+  }
+
+  auto dropped_count = dropped_sample_count.exchange(0, std::memory_order_relaxed);
+  if (dropped_count != 0) {
+    LOG(WARNING) << "Dropped " << dropped_count << " profiler samples";
+  }
+  if (need_reset) {
+    aggregated_stacks.clear();
+  }
+  return result;
+}
+
+#else
+
+td::Status Profiler::start(td::int32 frequency) {
+  return td::Status::Error("Profiler isn't supported on the platform");
+}
+
+void Profiler::stop() {
+}
+
+bool Profiler::is_running() {
+  return false;
+}
+
+void Profiler::set_thread_scheduler_id(td::int32 scheduler_id) {
+}
+
+void Profiler::flush() {
+}
+
+td::string Profiler::get_folded_stacks(bool need_reset) {
+  return td::string();
+}
+
+#endif
+
+}  // namespace telegram_bot_api
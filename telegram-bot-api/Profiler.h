@@ -0,0 +1,41 @@
+//
+// Copyright Aliaksei Levin (levlam@telegram.org), Arseny Smirnov (arseny30@gmail.com) 2014-2025
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#pragma once
+
+#include "td/utils/common.h"
+#include "td/utils/Status.h"
+
+namespace telegram_bot_api {
+
+// sampling CPU profiler, which collects stacks of running threads by the profiling timer signal;
+// stacks are unwound by backtrace() in the signal handler, which isn't async-signal-safe: with libgcc older than 12 or
+// glibc older than 2.35 it takes the dynamic loader lock, so a thread interrupted while loading a library or
+// unwinding an exception can deadlock; because of this, the profiler is disabled by default and must be enabled
+// explicitly only for short periods of time
+class Profiler {
+ public:
+  static constexpr td::int32 DEFAULT_FREQUENCY = 100;
+  static constexpr td::int32 MAX_FREQUENCY = 1000;
+
+  // frequency is the number of samples per second of CPU time consumed by the process
+  static td::Status start(td::int32 frequency);
+
+  static void stop();
+
+  static bool is_running();
+
+  // sets identifier of the scheduler of the current thread; it is used as the root frame of all stacks of the thread
+  static void set_thread_scheduler_id(td::int32 scheduler_id);
+
+  // moves new samples to the aggregated statistics; must be called periodically to avoid loss of samples
+  static void flush();
+
+  // returns aggregated stacks in the folded format, which is used by flame graph generators
+  static td::string get_folded_stacks(bool need_reset);
+};
+
+}  // namespace telegram_bot_api
@@ -6,6 +6,8 @@
 //
 #include "telegram-bot-api/Query.h"
 
+#include "telegram-bot-api/Client.h"
+
 #include "telegram-bot-api/Stats.h"
 
 #include "td/actor/actor.h"
@@ -102,6 +104,14 @@ void Query::set_error(int http_status_code, td::BufferSlice result) {
   send_response_stat();
 }
 
+void Query::set_stream() {
+  LOG(INFO) << "Query " << this << ": " << td::tag("method", method_) << " is answered with a stream";
+  CHECK(state_ == State::Query);
+  state_ = State::Stream;
+  http_status_code_ = 200;
+  send_response_stat();
+}
+
 void Query::set_retry_after_error(int retry_after) {
   retry_after_ = retry_after;
 
@@ -141,12 +151,22 @@ td::StringBuilder &operator<<(td::StringBuilder &sb, const Query &query) {
   return sb;
 }
 
+template <class EventT>
+static void add_stat_event(td::ActorId<BotStatActor> stat_actor, const EventT &event, double now) {
+  if (td::Scheduler::instance()->sched_id() == SharedData::get_client_scheduler_id() && stat_actor.is_alive()) {
+    // statistics actors are created on the client scheduler, so they can be updated directly without a message
+    stat_actor.get_actor_unsafe()->add_event(event, now);
+  } else {
+    send_closure(stat_actor, &BotStatActor::add_event<EventT>, event, now);
+  }
+}
+
 void Query::send_request_stat() const {
   if (stat_actor_.empty()) {
     return;
   }
-  send_closure(stat_actor_, &BotStatActor::add_event<ServerBotStat::Request>,
-               ServerBotStat::Request{query_size(), file_count(), files_size(), files_max_size()}, td::Time::now());
+  add_stat_event(stat_actor_, ServerBotStat::Request{query_size(), file_count(), files_size(), files_max_size()},
+                 td::Time::now());
 }
 
 void Query::send_response_stat() const {
@@ -159,8 +179,12 @@ void Query::send_response_stat() const {
   if (stat_actor_.empty()) {
     return;
   }
-  send_closure(stat_actor_, &BotStatActor::add_event<ServerBotStat::Response>,
-               ServerBotStat::Response{state_ == State::OK, answer_.size(), file_count(), files_size()}, now);
+  // the method name is usually found when the query is dispatched, so it doesn't need to be looked up again
+  auto stat_method_name = stat_method_name_.empty() ? Client::get_stat_method_name(method_) : stat_method_name_;
+  add_stat_event(stat_actor_,
+                 ServerBotStat::Response{state_ != State::Error, answer_.size(), file_count(), files_size(),
+                                         stat_method_name, now - start_timestamp_},
+                 now);
 }
 
 }  // namespace telegram_bot_api
@@ -30,10 +30,11 @@
 namespace telegram_bot_api {
 
 class BotStatActor;
+class HttpConnection;
 
 class Query final : public td::ListNode {
  public:
-  enum class State : td::int8 { Query, OK, Error };
+  enum class State : td::int8 { Query, OK, Error, Stream };
 
   td::Slice token() const {
     return token_;
@@ -100,10 +101,25 @@ class Query final : public td::ListNode {
 
   void set_retry_after_error(int retry_after);
 
+  // the response will be sent in parts directly to the HTTP connection
+  void set_stream();
+
+  bool is_stream() const {
+    return state_ == State::Stream;
+  }
+
   bool is_ready() const {
     return state_ != State::Query;
   }
 
+  td::ActorId<HttpConnection> http_connection_id() const {
+    return http_connection_id_;
+  }
+
+  void set_http_connection_id(td::ActorId<HttpConnection> http_connection_id) {
+    http_connection_id_ = http_connection_id;
+  }
+
   bool is_internal() const {
     return is_internal_;
   }
@@ -133,12 +149,18 @@ class Query final : public td::ListNode {
 
   void set_stat_actor(td::ActorId<BotStatActor> stat_actor);
 
+  // sets the method name with static storage duration, which will be used in statistics
+  void set_stat_method_name(td::Slice stat_method_name) {
+    stat_method_name_ = stat_method_name;
+  }
+
  private:
   State state_;
   std::shared_ptr<SharedData> shared_data_;
   double start_timestamp_;
   td::IPAddress peer_ip_address_;
   td::ActorId<BotStatActor> stat_actor_;
+  td::Slice stat_method_name_;
 
   // request
   td::vector<td::BufferSlice> container_;
@@ -149,6 +171,7 @@ class Query final : public td::ListNode {
   td::vector<std::pair<td::MutableSlice, td::MutableSlice>> headers_;
   td::vector<td::HttpFile> files_;
   bool is_internal_ = false;
+  td::ActorId<HttpConnection> http_connection_id_;
 
   // response
   td::BufferSlice answer_;
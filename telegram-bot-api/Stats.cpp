@@ -6,12 +6,15 @@
 //
 #include "telegram-bot-api/Stats.h"
 
+#include "td/utils/bits.h"
 #include "td/utils/common.h"
 #include "td/utils/logging.h"
 #include "td/utils/port/thread.h"
 #include "td/utils/SliceBuilder.h"
 #include "td/utils/StringBuilder.h"
 
+#include <algorithm>
+
 namespace telegram_bot_api {
 
 ServerCpuStat::ServerCpuStat() {
@@ -51,6 +54,20 @@ static td::string to_percentage(td::uint64 ticks, td::uint64 total_ticks) {
   return PSTRING() << (static_cast<double>(ticks) / static_cast<double>(total_ticks) * multiplier) << '%';
 }
 
+td::Result<CpuUsage> CpuStat::get_usage() const {
+  if (cnt_ < 2 || first_.total_ticks_ >= last_.total_ticks_) {
+    return td::Status::Error("Unknown");
+  }
+  static double cpu_count =
+      static_cast<double>(td::thread::hardware_concurrency() ? td::thread::hardware_concurrency() : 1);
+  auto total_ticks = static_cast<double>(last_.total_ticks_ - first_.total_ticks_);
+  CpuUsage result;
+  result.user_ = static_cast<double>(last_.process_user_ticks_ - first_.process_user_ticks_) / total_ticks * cpu_count;
+  result.system_ =
+      static_cast<double>(last_.process_system_ticks_ - first_.process_system_ticks_) / total_ticks * cpu_count;
+  return result;
+}
+
 td::vector<StatItem> CpuStat::as_vector() const {
   td::vector<StatItem> res;
   if (cnt_ < 2 || first_.total_ticks_ >= last_.total_ticks_) {
@@ -68,6 +85,122 @@ td::vector<StatItem> CpuStat::as_vector() const {
   return res;
 }
 
+std::size_t Histogram::get_bucket(td::uint64 value) {
+  constexpr td::uint64 SUB_BUCKET_COUNT = static_cast<td::uint64>(1) << SUB_BUCKET_BITS;
+  if (value < SUB_BUCKET_COUNT) {
+    return static_cast<std::size_t>(value);
+  }
+  auto shift = 63 - td::count_leading_zeroes64(value) - SUB_BUCKET_BITS;
+  return static_cast<std::size_t>(((shift + 1) << SUB_BUCKET_BITS) + (value >> shift) - SUB_BUCKET_COUNT);
+}
+
+td::uint64 Histogram::get_bucket_upper_bound(std::size_t bucket) {
+  constexpr std::size_t SUB_BUCKET_COUNT = static_cast<std::size_t>(1) << SUB_BUCKET_BITS;
+  if (bucket < SUB_BUCKET_COUNT) {
+    return bucket + 1;
+  }
+  auto shift = static_cast<int>(bucket >> SUB_BUCKET_BITS) - 1;
+  auto mantissa = static_cast<td::uint64>((bucket & (SUB_BUCKET_COUNT - 1)) + SUB_BUCKET_COUNT);
+  return (mantissa + 1) << shift;
+}
+
+void Histogram::add(td::uint64 value) {
+  value = td::min(value, max_value_);
+  auto bucket = get_bucket(value);
+  CHECK(bucket < BUCKET_COUNT);
+  if (bucket >= buckets_.size()) {
+    buckets_.resize(bucket + 1);
+  }
+  buckets_[bucket]++;
+  count_++;
+  sum_ += value;
+}
+
+td::vector<std::pair<td::uint64, td::uint64>> Histogram::get_buckets() const {
+  td::vector<std::pair<td::uint64, td::uint64>> result;
+  td::uint64 total_count = 0;
+  for (std::size_t i = 0; i < buckets_.size(); i++) {
+    if (buckets_[i] != 0) {
+      total_count += buckets_[i];
+      // all values in a bucket are less than its upper bound
+      result.emplace_back(get_bucket_upper_bound(i) - 1, total_count);
+    }
+  }
+  return result;
+}
+
+td::uint64 Histogram::get_percentile(double fraction) const {
+  if (count_ == 0) {
+    return 0;
+  }
+  auto rank = td::max(static_cast<td::uint64>(fraction * static_cast<double>(count_)), static_cast<td::uint64>(1));
+  td::uint64 total_count = 0;
+  for (std::size_t i = 0; i < buckets_.size(); i++) {
+    total_count += buckets_[i];
+    if (total_count >= rank) {
+      return get_bucket_upper_bound(i);
+    }
+  }
+  return get_bucket_upper_bound(buckets_.size() - 1);
+}
+
+td::string Histogram::get_percentiles() const {
+  return PSTRING() << "p50=" << get_percentile(0.5) << " p99=" << get_percentile(0.99)
+                   << " p999=" << get_percentile(0.999) << " count=" << get_count();
+}
+
+void Histogram::clear() {
+  td::reset_to_empty(buckets_);
+  count_ = 0;
+  sum_ = 0;
+}
+
+void LatencyHistogram::add(double duration) {
+  constexpr double MAX_DURATION = 1e12;
+  td::uint64 value = 0;
+  if (duration > 0) {
+    value = static_cast<td::uint64>(td::min(duration, MAX_DURATION) * 1e6);
+  }
+  histogram_.add(value);
+}
+
+td::string LatencyHistogram::get_percentiles() const {
+  return PSTRING() << "p50=" << get_percentile(0.5) << " p99=" << get_percentile(0.99)
+                   << " p999=" << get_percentile(0.999) << " count=" << get_count();
+}
+
+void WebhookLatencyStats::clear() {
+  first_send_.clear();
+  response_.clear();
+  delivery_.clear();
+}
+
+td::vector<StatItem> WebhookLatencyStats::as_vector() const {
+  td::vector<StatItem> res;
+  auto add_histogram = [&res](td::Slice name, const LatencyHistogram &histogram) {
+    if (histogram.get_count() != 0) {
+      res.push_back({name.str(), histogram.get_percentiles()});
+    }
+  };
+  add_histogram("webhook_first_send_latency", first_send_);
+  add_histogram("webhook_response_latency", response_);
+  add_histogram("webhook_delivery_latency", delivery_);
+  return res;
+}
+
+td::vector<std::pair<td::Slice, CpuUsage>> ServerCpuStat::get_usage(double now) {
+  std::lock_guard<std::mutex> guard(mutex_);
+
+  td::vector<std::pair<td::Slice, CpuUsage>> res;
+  for (std::size_t i = 0; i < SIZE; i++) {
+    auto r_usage = stat_[i].get_stat(now).get_usage();
+    if (r_usage.is_ok()) {
+      res.emplace_back(td::Slice(DESCR[i]), r_usage.move_as_ok());
+    }
+  }
+  return res;
+}
+
 td::vector<StatItem> ServerCpuStat::as_vector(double now) {
   std::lock_guard<std::mutex> guard(mutex_);
 
@@ -148,6 +281,110 @@ td::vector<StatItem> BotStatActor::as_vector(double now) {
   return res;
 }
 
+ServerBotStat BotStatActor::get_total_stat(double now) {
+  return stat_[0].stat_duration(now).first;
+}
+
+ServerBotStat BotStatActor::get_minute_stat(double now) {
+  auto minute_stat = stat_[2].stat_duration(now);
+  minute_stat.first.normalize(minute_stat.second);
+  return minute_stat.first;
+}
+
+void DailyActiveCounter::on_activity(td::int64 old_hour, td::int64 new_hour) {
+  if (old_hour != -1) {
+    on_remove(old_hour);
+  }
+  auto &slot = slots_[static_cast<std::size_t>(new_hour) % SLOT_COUNT];
+  if (slot.hour_ != new_hour) {
+    // the slot contains objects, which weren't active during the last day
+    slot.hour_ = new_hour;
+    slot.count_ = 0;
+  }
+  slot.count_++;
+}
+
+void DailyActiveCounter::on_remove(td::int64 hour) {
+  auto &slot = slots_[static_cast<std::size_t>(hour) % SLOT_COUNT];
+  if (slot.hour_ == hour) {
+    CHECK(slot.count_ > 0);
+    slot.count_--;
+  }
+}
+
+td::int32 DailyActiveCounter::get_count(double now) const {
+  auto hour = get_hour(now);
+  td::int32 result = 0;
+  for (auto &slot : slots_) {
+    if (slot.hour_ <= hour && slot.hour_ > hour - static_cast<td::int64>(SLOT_COUNT)) {
+      result += slot.count_;
+    }
+  }
+  return result;
+}
+
+td::string MethodStat::get_description() const {
+  td::StringBuilder sb(td::MutableSlice(), true);
+  sb << "error_count=" << error_count_ << " average_latency=" << get_average_duration();
+  if (latency_ != nullptr) {
+    sb << ' ' << latency_->get_percentiles();
+  } else {
+    sb << " count=" << request_count_;
+  }
+  return sb.as_cslice().str();
+}
+
+td::vector<std::pair<td::Slice, const MethodStat *>> BotStatActor::get_method_stats() const {
+  td::vector<std::pair<td::Slice, const MethodStat *>> result;
+  result.reserve(method_stats_.size());
+  for (auto &it : method_stats_) {
+    result.emplace_back(td::Slice(it.first), &it.second);
+  }
+  std::sort(result.begin(), result.end(), [](const auto &lhs, const auto &rhs) {
+    if (lhs.second->request_count_ != rhs.second->request_count_) {
+      return lhs.second->request_count_ > rhs.second->request_count_;
+    }
+    return lhs.first < rhs.first;
+  });
+  return result;
+}
+
+void BotStatActor::on_method_response(const ServerBotStat::Response &response, double now) {
+  // only known methods are tracked, so the number of entries is limited
+  auto &method_stat = method_stats_[response.method_.begin()];
+  method_stat.request_count_++;
+  if (!response.ok_) {
+    method_stat.error_count_++;
+  }
+  method_stat.total_duration_ += response.duration_;
+
+  // the aggregate statistics always have latency histograms; bots have them only for methods, which are currently
+  // used frequently, because there can be too many bots to keep a histogram for each of their methods
+  if (parent_.empty()) {
+    if (method_stat.latency_ == nullptr) {
+      method_stat.latency_ = td::make_unique<LatencyHistogram>();
+    }
+  } else {
+    if (now >= method_stat.rate_period_start_time_ + LATENCY_HISTOGRAM_RATE_PERIOD) {
+      if (method_stat.rate_period_request_count_ < MIN_LATENCY_HISTOGRAM_REQUEST_COUNT ||
+          now >= method_stat.rate_period_start_time_ + 2 * LATENCY_HISTOGRAM_RATE_PERIOD) {
+        // the method isn't used frequently anymore
+        method_stat.latency_ = nullptr;
+      }
+      method_stat.rate_period_start_time_ = now;
+      method_stat.rate_period_request_count_ = 0;
+    }
+    method_stat.rate_period_request_count_++;
+    if (method_stat.latency_ == nullptr &&
+        method_stat.rate_period_request_count_ >= MIN_LATENCY_HISTOGRAM_REQUEST_COUNT) {
+      method_stat.latency_ = td::make_unique<LatencyHistogram>();
+    }
+  }
+  if (method_stat.latency_ != nullptr) {
+    method_stat.latency_->add(response.duration_);
+  }
+}
+
 td::string BotStatActor::get_description() {
   td::string res = "DURATION";
   for (auto &descr : DESCR) {
@@ -194,8 +431,15 @@ td::int64 BotStatActor::get_active_file_upload_count() const {
   return active_file_upload_count_;
 }
 
-bool BotStatActor::is_active(double now) const {
-  return last_activity_timestamp_ > now - 86400;
+void BotStatActor::on_remove() {
+  if (!parent_.empty() && last_activity_hour_ != -1) {
+    parent_.get_actor_unsafe()->daily_active_child_counter_.on_remove(last_activity_hour_);
+    last_activity_hour_ = -1;
+  }
+}
+
+bool BotStatActor::is_recently_active(double now) const {
+  return last_activity_timestamp_ > now - RECENT_ACTIVITY_PERIOD || active_request_count_ != 0;
 }
 
 }  // namespace telegram_bot_api
@@ -9,11 +9,17 @@
 #include "td/actor/actor.h"
 
 #include "td/utils/common.h"
+#include "td/utils/FlatHashMap.h"
+#include "td/utils/HashTableUtils.h"
 #include "td/utils/port/Stat.h"
+#include "td/utils/Slice.h"
+#include "td/utils/Status.h"
 #include "td/utils/Time.h"
 #include "td/utils/TimedStat.h"
 
+#include <cstdint>
 #include <mutex>
+#include <utility>
 
 namespace telegram_bot_api {
 
@@ -22,6 +28,11 @@ struct StatItem {
   td::string value_;
 };
 
+struct CpuUsage {
+  double user_ = 0.0;  // in fully used CPU cores
+  double system_ = 0.0;
+};
+
 class CpuStat {
  public:
   void on_event(const td::CpuStat &event) {
@@ -36,6 +47,8 @@ class CpuStat {
 
   td::vector<StatItem> as_vector() const;
 
+  td::Result<CpuUsage> get_usage() const;
+
  private:
   int cnt_ = 0;
   td::CpuStat first_;
@@ -55,6 +68,9 @@ class ServerCpuStat {
 
   td::vector<StatItem> as_vector(double now);
 
+  // returns known CPU usage for all durations together with their descriptions
+  td::vector<std::pair<td::Slice, CpuUsage>> get_usage(double now);
+
  private:
   static constexpr std::size_t SIZE = 4;
   static constexpr const char *DESCR[SIZE] = {"inf", "5sec", "1min", "1hour"};
@@ -66,6 +82,96 @@ class ServerCpuStat {
   ServerCpuStat();
 };
 
+// log-linear histogram with relative error of bucket boundaries at most 1/8
+class Histogram {
+ public:
+  Histogram() = default;
+
+  // values greater than max_value are counted as max_value, so the histogram never has more buckets than needed
+  // for max_value; for values up to 100 there are at most 37 buckets
+  explicit Histogram(td::uint64 max_value) : max_value_(td::min(max_value, MAX_VALUE)) {
+  }
+
+  void add(td::uint64 value);
+
+  td::uint64 get_count() const {
+    return count_;
+  }
+
+  td::uint64 get_sum() const {
+    return sum_;
+  }
+
+  // returns inclusive upper bounds of all non-empty buckets together with cumulative counts of values in them
+  td::vector<std::pair<td::uint64, td::uint64>> get_buckets() const;
+
+  // returns upper bound of the bucket containing the value with the given rank
+  td::uint64 get_percentile(double fraction) const;
+
+  td::string get_percentiles() const;
+
+  // removes all values and frees the memory used by the histogram
+  void clear();
+
+ private:
+  static constexpr int SUB_BUCKET_BITS = 3;
+  static constexpr int MAX_VALUE_BITS = 40;
+  static constexpr std::size_t BUCKET_COUNT = static_cast<std::size_t>(MAX_VALUE_BITS - SUB_BUCKET_BITS + 1)
+                                              << SUB_BUCKET_BITS;
+  static constexpr td::uint64 MAX_VALUE = (static_cast<td::uint64>(1) << MAX_VALUE_BITS) - 1;
+
+  static std::size_t get_bucket(td::uint64 value);
+
+  static td::uint64 get_bucket_upper_bound(std::size_t bucket);
+
+  td::vector<td::uint32> buckets_;  // allocated only up to the bucket of the largest added value
+  td::uint64 max_value_ = MAX_VALUE;
+  td::uint64 count_ = 0;
+  td::uint64 sum_ = 0;
+};
+
+// histogram of durations, which are stored in microseconds
+class LatencyHistogram {
+ public:
+  void add(double duration);
+
+  td::uint64 get_count() const {
+    return histogram_.get_count();
+  }
+
+  double get_percentile(double fraction) const {
+    return static_cast<double>(histogram_.get_percentile(fraction)) * 1e-6;
+  }
+
+  td::string get_percentiles() const;
+
+  const Histogram &get_histogram() const {
+    return histogram_;
+  }
+
+  void clear() {
+    histogram_.clear();
+  }
+
+ private:
+  Histogram histogram_;
+};
+
+struct WebhookLatencyStats {
+  LatencyHistogram first_send_;  // from receiving of an update to the first attempt to send it
+  LatencyHistogram response_;    // from sending of a request to receiving of a successful response
+  LatencyHistogram delivery_;    // from receiving of an update to its successful delivery
+  double last_add_time_ = 0;
+
+  bool empty() const {
+    return first_send_.get_count() == 0 && response_.get_count() == 0 && delivery_.get_count() == 0;
+  }
+
+  void clear();
+
+  td::vector<StatItem> as_vector() const;
+};
+
 class ServerBotInfo {
  public:
   td::string id_;
@@ -77,6 +183,10 @@ class ServerBotInfo {
   td::int32 tail_update_id_ = 0;
   td::int32 webhook_max_connections_ = 0;
   std::size_t pending_update_count_ = 0;
+  std::size_t webhook_connection_count_ = 0;
+  std::size_t webhook_active_request_count_ = 0;
+  td::int32 last_webhook_error_date_ = 0;
+  td::string last_webhook_error_message_;
   double start_time_ = 0;
 };
 
@@ -108,6 +218,8 @@ struct ServerBotStat {
     size_t size_;
     td::int64 file_count_;
     td::int64 files_size_;
+    td::Slice method_;  // a known method name with static storage duration, or "<other>"
+    double duration_;
   };
   void on_event(const Response &response) {
     response_count_++;
@@ -136,6 +248,46 @@ struct ServerBotStat {
   td::vector<StatItem> as_vector() const;
 };
 
+// number of objects, which were active during the last day, with precision of one hour
+class DailyActiveCounter {
+ public:
+  static td::int64 get_hour(double now) {
+    return static_cast<td::int64>(now / 3600.0);
+  }
+
+  // an object, which was last active in old_hour, or -1 if it wasn't active, became active in new_hour
+  void on_activity(td::int64 old_hour, td::int64 new_hour);
+
+  // an object, which was last active in the hour, was removed
+  void on_remove(td::int64 hour);
+
+  td::int32 get_count(double now) const;
+
+ private:
+  static constexpr std::size_t SLOT_COUNT = 25;  // the current hour and 24 previous hours
+
+  struct Slot {
+    td::int64 hour_ = -1;
+    td::int32 count_ = 0;
+  };
+  Slot slots_[SLOT_COUNT];
+};
+
+struct MethodStat {
+  td::uint64 request_count_ = 0;
+  td::uint64 error_count_ = 0;
+  double total_duration_ = 0.0;  // from receiving of a request to sending of the response
+  td::unique_ptr<LatencyHistogram> latency_;  // allocated only for frequently used methods
+  double rate_period_start_time_ = 0.0;
+  td::uint64 rate_period_request_count_ = 0;
+
+  double get_average_duration() const {
+    return request_count_ == 0 ? 0.0 : total_duration_ / static_cast<double>(request_count_);
+  }
+
+  td::string get_description() const;
+};
+
 class BotStatActor final : public td::Actor {
  public:
   BotStatActor() = default;
@@ -156,6 +308,12 @@ class BotStatActor final : public td::Actor {
     this->Actor::operator=(std::move(other));
     std::move(other.stat_, other.stat_ + SIZE, stat_);
     parent_ = other.parent_;
+    method_stats_ = std::move(other.method_stats_);
+    id_ = other.id_;
+    is_in_recently_active_list_ = other.is_in_recently_active_list_;
+    recently_active_child_ids_ = std::move(other.recently_active_child_ids_);
+    last_activity_hour_ = other.last_activity_hour_;
+    daily_active_child_counter_ = other.daily_active_child_counter_;
     return *this;
   }
   ~BotStatActor() final = default;
@@ -166,14 +324,34 @@ class BotStatActor final : public td::Actor {
     for (auto &stat : stat_) {
       stat.add_event(event, now);
     }
-    on_event(event);
+    on_event(event, now);
     if (!parent_.empty()) {
-      send_closure(parent_, &BotStatActor::add_event<EventT>, event, now);
+      // the parent is owned by the same actor as its children, so it is updated directly
+      auto *parent = parent_.get_actor_unsafe();
+      if (!is_in_recently_active_list_) {
+        is_in_recently_active_list_ = true;
+        parent->recently_active_child_ids_.push_back(id_);
+      }
+      auto activity_hour = DailyActiveCounter::get_hour(now);
+      if (activity_hour != last_activity_hour_) {
+        parent->daily_active_child_counter_.on_activity(last_activity_hour_, activity_hour);
+        last_activity_hour_ = activity_hour;
+      }
+      parent->add_event(event, now);
     }
   }
 
   td::vector<StatItem> as_vector(double now);
 
+  // returns statistics for the whole lifetime
+  ServerBotStat get_total_stat(double now);
+
+  // returns statistics for the last minute normalized to one second
+  ServerBotStat get_minute_stat(double now);
+
+  // returns statistics of methods for the whole lifetime sorted by decreasing number of requests
+  td::vector<std::pair<td::Slice, const MethodStat *>> get_method_stats() const;
+
   static td::string get_description();
 
   double get_score(double now);
@@ -186,24 +364,62 @@ class BotStatActor final : public td::Actor {
 
   td::int64 get_active_file_upload_count() const;
 
-  bool is_active(double now) const;
+  // returns the number of children, which had events during the last day
+  td::int32 get_daily_active_child_count(double now) const {
+    return daily_active_child_counter_.get_count(now);
+  }
+
+  // must be called before the actor is destroyed to remove it from the statistics of the parent
+  void on_remove();
+
+  // returns whether there were events during the last minute or there are active requests
+  bool is_recently_active(double now) const;
+
+  void set_id(td::uint64 id) {
+    id_ = id;
+  }
+
+  // identifiers of children, which had events since they were removed from the list last time
+  td::vector<td::uint64> &get_recently_active_child_ids() {
+    return recently_active_child_ids_;
+  }
+
+  void on_removed_from_recently_active_list() {
+    is_in_recently_active_list_ = false;
+  }
 
  private:
   static constexpr std::size_t SIZE = 4;
   static constexpr const char *DESCR[SIZE] = {"inf", "5sec", "1min", "1hour"};
   static constexpr td::int32 DURATIONS[SIZE] = {0, 5, 60, 60 * 60};
+  static constexpr double LATENCY_HISTOGRAM_RATE_PERIOD = 60.0;
+  static constexpr td::uint64 MIN_LATENCY_HISTOGRAM_REQUEST_COUNT = 60;  // per LATENCY_HISTOGRAM_RATE_PERIOD
+  static constexpr double RECENT_ACTIVITY_PERIOD = 60.0;
 
   td::TimedStat<ServerBotStat> stat_[SIZE];
   td::ActorId<BotStatActor> parent_;
+  struct MethodNameHash {
+    td::uint32 operator()(const char *method_name) const {
+      return td::Hash<td::uint64>()(static_cast<td::uint64>(reinterpret_cast<std::uintptr_t>(method_name)));
+    }
+  };
+  // method names have static storage duration, so they are identified by their address
+  td::FlatHashMap<const char *, MethodStat, MethodNameHash> method_stats_;
+  td::uint64 id_ = 0;  // identifier of the actor among children of its parent
+  bool is_in_recently_active_list_ = false;
+  td::vector<td::uint64> recently_active_child_ids_;
+  td::int64 last_activity_hour_ = -1;
+  DailyActiveCounter daily_active_child_counter_;
   double last_activity_timestamp_ = -1e9;
   td::int64 active_request_count_ = 0;
   td::int64 active_file_upload_bytes_ = 0;
   td::int64 active_file_upload_count_ = 0;
 
-  void on_event(const ServerBotStat::Update &update) {
+  void on_event(const ServerBotStat::Update &update, double now) {
   }
 
-  void on_event(const ServerBotStat::Response &response) {
+  void on_event(const ServerBotStat::Response &response, double now) {
+    on_method_response(response, now);
     active_request_count_--;
     active_file_upload_count_ -= response.file_count_;
     active_file_upload_bytes_ -= response.files_size_;
@@ -211,11 +427,22 @@ class BotStatActor final : public td::Actor {
     CHECK(active_file_upload_bytes_ >= 0);
   }
 
-  void on_event(const ServerBotStat::Request &request) {
+  void on_event(const ServerBotStat::Request &request, double now) {
     active_request_count_++;
     active_file_upload_count_ += request.file_count_;
     active_file_upload_bytes_ += request.files_size_;
   }
+
+  void on_method_response(const ServerBotStat::Response &response, double now);
+};
+
+struct BotStatSnapshot {
+  ServerBotInfo info_;
+  ServerBotStat minute_stat_;
+  double score_ = 0.0;
+  td::int64 active_request_count_ = 0;
+  td::int64 active_file_upload_bytes_ = 0;
+  td::int64 active_file_upload_count_ = 0;
 };
 
 }  // namespace telegram_bot_api
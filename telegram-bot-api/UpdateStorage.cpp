@@ -0,0 +1,138 @@
+//
+// Copyright Aliaksei Levin (levlam@telegram.org), Arseny Smirnov (arseny30@gmail.com) 2014-2025
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#include "telegram-bot-api/UpdateStorage.h"
+
+#include "td/utils/config.h"
+#include "td/utils/Gzip.h"
+#include "td/utils/logging.h"
+#include "td/utils/port/thread_local.h"
+
+namespace telegram_bot_api {
+
+td::string pack_update(td::Slice update, std::size_t compression_threshold) {
+  CHECK(!update.empty() && update[0] == '"');
+#if TD_HAVE_ZLIB
+  if (compression_threshold != 0 && update.size() >= compression_threshold) {
+    auto compressed_update = td::gzencode(update, 0.9);
+    if (!compressed_update.empty()) {
+      CHECK(is_packed_update(compressed_update.as_slice()));
+      return compressed_update.as_slice().str();
+    }
+  }
+#endif
+  return update.str();
+}
+
+bool is_packed_update(td::Slice data) {
+  return !data.empty() && data[0] != '"';
+}
+
+td::vector<td::TQueue::EventId> unpack_updates(td::MutableSpan<td::TQueue::Event> &events,
+                                               td::vector<td::BufferSlice> &storage) {
+  td::vector<td::TQueue::EventId> failed_event_ids;
+  size_t result_size = 0;
+  for (size_t i = 0; i < events.size(); i++) {
+    auto event = events[i];
+    if (is_packed_update(event.data)) {
+#if TD_HAVE_ZLIB
+      auto update = td::gzdecode(event.data);
+#else
+      td::BufferSlice update;
+#endif
+      if (update.empty() || is_packed_update(update.as_slice())) {
+        LOG(ERROR) << "Failed to unpack update " << event.id;
+        failed_event_ids.push_back(event.id);
+        continue;
+      }
+      event.data = update.as_slice();
+      storage.push_back(std::move(update));
+    }
+    events[result_size++] = event;
+  }
+  events.truncate(result_size);
+  return failed_event_ids;
+}
+
+namespace {
+
+class TQueueEventStoragePool {
+ public:
+  td::vector<td::TQueue::Event> acquire() {
+    if (free_storages_.empty()) {
+      return {};
+    }
+    auto result = std::move(free_storages_.back());
+    free_storages_.pop_back();
+    return result;
+  }
+
+  void release(td::vector<td::TQueue::Event> &&storage) {
+    if (free_storages_.size() < MAX_FREE_STORAGES) {
+      free_storages_.push_back(std::move(storage));
+    }
+  }
+
+ private:
+  static constexpr size_t MAX_FREE_STORAGES = 4;
+
+  td::vector<td::vector<td::TQueue::Event>> free_storages_;
+};
+
+TQueueEventStoragePool &get_event_storage_pool() {
+  static TD_THREAD_LOCAL TQueueEventStoragePool *pool;
+  if (pool == nullptr) {
+    td::init_thread_local<TQueueEventStoragePool>(pool);
+  }
+  return *pool;
+}
+
+}  // namespace
+
+TQueueEventBuffer::TQueueEventBuffer(size_t max_event_count) : storage_(get_event_storage_pool().acquire()) {
+  CHECK(max_event_count <= MAX_EVENT_COUNT);
+  storage_.resize(max_event_count);
+  events_ = td::MutableSpan<td::TQueue::Event>(storage_.data(), max_event_count);
+}
+
+TQueueEventBuffer::~TQueueEventBuffer() {
+  get_event_storage_pool().release(std::move(storage_));
+}
+
+td::Result<size_t> TQueueEventBuffer::get(td::TQueue &tqueue, td::int64 queue_id, td::TQueue::EventId from_id,
+                                          bool forget_previous, td::int32 unix_time_now) {
+  events_ = td::MutableSpan<td::TQueue::Event>(storage_.data(), storage_.size());
+  unpacked_updates_.clear();
+  received_event_count_ = 0;
+  next_event_id_ = td::TQueue::EventId();
+  auto r_total_size = tqueue.get(queue_id, from_id, forget_previous, unix_time_now, events_);
+  if (r_total_size.is_error()) {
+    events_.truncate(0);
+    return r_total_size.move_as_error();
+  }
+  auto total_size = r_total_size.move_as_ok();
+  received_event_count_ = events_.size();
+  if (!events_.empty()) {
+    next_event_id_ = events_.back().id.next().move_as_ok();
+  }
+
+  auto failed_event_ids = unpack_updates(events_, unpacked_updates_);
+  for (auto event_id : failed_event_ids) {
+    // the event will never be delivered, so it must not be returned again
+    tqueue.forget(queue_id, event_id);
+  }
+  CHECK(total_size >= failed_event_ids.size());
+  return total_size - failed_event_ids.size();
+}
+
+void TQueueEventBuffer::clear() {
+  events_.truncate(0);
+  unpacked_updates_.clear();
+  received_event_count_ = 0;
+  next_event_id_ = td::TQueue::EventId();
+}
+
+}  // namespace telegram_bot_api
@@ -0,0 +1,74 @@
+//
+// Copyright Aliaksei Levin (levlam@telegram.org), Arseny Smirnov (arseny30@gmail.com) 2014-2025
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#pragma once
+
+#include "td/db/TQueue.h"
+
+#include "td/utils/buffer.h"
+#include "td/utils/common.h"
+#include "td/utils/Slice.h"
+#include "td/utils/Span.h"
+#include "td/utils/Status.h"
+
+namespace telegram_bot_api {
+
+// Updates are stored in TQueue either as is, or gzip-compressed.
+// Stored JSON always begins with '"', therefore the formats can't be confused and both can be present in the same queue.
+
+td::string pack_update(td::Slice update, std::size_t compression_threshold);
+
+bool is_packed_update(td::Slice data);
+
+// replaces data of compressed events with uncompressed data kept in the storage;
+// drops events, which can't be unpacked, and returns their identifiers
+td::vector<td::TQueue::EventId> unpack_updates(td::MutableSpan<td::TQueue::Event> &events,
+                                               td::vector<td::BufferSlice> &storage);
+
+// Unpacked events, received from TQueue in a single request.
+// Memory for events is reused between requests made from the same thread instead of using a single global array.
+// Data of packed events is owned by the buffer, data of other events is valid until the next change of the queue.
+// Events, which can't be unpacked, are forgotten, so they don't block delivery of subsequent events.
+class TQueueEventBuffer {
+ public:
+  static constexpr size_t MAX_EVENT_COUNT = 1000;
+
+  explicit TQueueEventBuffer(size_t max_event_count);
+  TQueueEventBuffer(const TQueueEventBuffer &) = delete;
+  TQueueEventBuffer &operator=(const TQueueEventBuffer &) = delete;
+  TQueueEventBuffer(TQueueEventBuffer &&) = delete;
+  TQueueEventBuffer &operator=(TQueueEventBuffer &&) = delete;
+  ~TQueueEventBuffer();
+
+  // returns the total number of events in the queue starting from from_id
+  td::Result<size_t> get(td::TQueue &tqueue, td::int64 queue_id, td::TQueue::EventId from_id, bool forget_previous,
+                         td::int32 unix_time_now);
+
+  void clear();
+
+  td::MutableSpan<td::TQueue::Event> &events() {
+    return events_;
+  }
+
+  // returns the number of events received from TQueue, including events, which failed to be unpacked
+  size_t get_received_event_count() const {
+    return received_event_count_;
+  }
+
+  // returns identifier of the event following the last received event, or an empty identifier if there were none
+  td::TQueue::EventId get_next_event_id() const {
+    return next_event_id_;
+  }
+
+ private:
+  td::vector<td::TQueue::Event> storage_;
+  td::MutableSpan<td::TQueue::Event> events_;
+  td::vector<td::BufferSlice> unpacked_updates_;
+  size_t received_event_count_ = 0;
+  td::TQueue::EventId next_event_id_;
+};
+
+}  // namespace telegram_bot_api
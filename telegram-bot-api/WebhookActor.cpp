@@ -7,6 +7,7 @@
 #include "telegram-bot-api/WebhookActor.h"
 
 #include "telegram-bot-api/ClientParameters.h"
+#include "telegram-bot-api/UpdateStorage.h"
 
 #include "td/net/GetHostByNameActor.h"
 #include "td/net/HttpHeaderCreator.h"
@@ -16,7 +17,9 @@
 #include "td/utils/base64.h"
 #include "td/utils/buffer.h"
 #include "td/utils/common.h"
+#include "td/utils/config.h"
 #include "td/utils/format.h"
+#include "td/utils/Gzip.h"
 #include "td/utils/JsonBuilder.h"
 #include "td/utils/logging.h"
 #include "td/utils/misc.h"
@@ -29,15 +32,33 @@
 #include "td/utils/Span.h"
 #include "td/utils/Time.h"
 
+#include <algorithm>
+#include <functional>
+
 namespace telegram_bot_api {
 
 static int VERBOSITY_NAME(webhook) = VERBOSITY_NAME(DEBUG);
 
 std::atomic<td::uint64> WebhookActor::total_connection_count_{0};
+std::atomic<std::size_t> WebhookActor::total_loaded_update_size_{0};
+
+static std::atomic<td::uint64> thread_connection_counts[SharedData::MAX_SLOW_OUTGOING_HTTP_THREAD_COUNT];
+
+// all webhooks are handled on the client scheduler, so the statistics don't need synchronization
+static WebhookLatencyStats global_latency_stats;
+
+td::vector<td::uint64> WebhookActor::get_thread_connection_counts(td::int32 thread_count) {
+  td::vector<td::uint64> result;
+  for (td::int32 i = 0; i < thread_count; i++) {
+    result.push_back(thread_connection_counts[i].load(std::memory_order_relaxed));
+  }
+  return result;
+}
 
 WebhookActor::WebhookActor(td::ActorShared<Callback> callback, td::int64 tqueue_id, td::HttpUrl url,
-                           td::string cert_path, td::int32 max_connections, bool from_db_flag,
+                           td::string cert_path, td::int32 max_connections, td::int32 batch_size, bool from_db_flag,
                            td::string cached_ip_address, bool fix_ip_address, td::string secret_token,
+                           std::shared_ptr<WebhookLatencyStats> latency_stats,
                            std::shared_ptr<const ClientParameters> parameters)
     : callback_(std::move(callback))
     , tqueue_id_(tqueue_id)
@@ -47,8 +68,12 @@ WebhookActor::WebhookActor(td::ActorShared<Callback> callback, td::int64 tqueue_
     , fix_ip_address_(fix_ip_address)
     , from_db_flag_(from_db_flag)
     , max_connections_(max_connections)
-    , secret_token_(std::move(secret_token)) {
+    , batch_size_(batch_size)
+    , secret_token_(std::move(secret_token))
+    , latency_stats_(std::move(latency_stats)) {
+  CHECK(latency_stats_ != nullptr);
   CHECK(max_connections_ > 0);
+  CHECK(batch_size_ > 0);
 
   if (!cached_ip_address.empty()) {
     auto r_ip_address = td::IPAddress::get_ip_address(cached_ip_address);
@@ -67,7 +92,7 @@ WebhookActor::WebhookActor(td::ActorShared<Callback> callback, td::int64 tqueue_
   LOG(INFO) << "Set webhook for " << tqueue_id << " with certificate = \"" << cert_path_
             << "\", protocol = " << (url_.protocol_ == td::HttpUrl::Protocol::Http ? "http" : "https")
             << ", host = " << url_.host_ << ", port = " << url_.port_ << ", query = " << url_.query_
-            << ", max_connections = " << max_connections_;
+            << ", max_connections = " << max_connections_ << ", batch_size = " << batch_size_;
 }
 
 WebhookActor::~WebhookActor() {
@@ -143,6 +168,9 @@ void WebhookActor::on_ssl_context_created(td::Result<td::SslCtx> r_ssl_ctx) {
 
 td::Status WebhookActor::create_connection() {
   CHECK(ip_address_.is_valid());
+  if (reuse_pooled_connection()) {
+    return td::Status::OK();
+  }
   if (parameters_->webhook_proxy_ip_address_.is_valid()) {
     auto r_proxy_socket_fd = td::SocketFd::open(parameters_->webhook_proxy_ip_address_);
     if (r_proxy_socket_fd.is_error()) {
@@ -227,22 +255,100 @@ td::Status WebhookActor::create_connection(td::BufferedFd<td::SocketFd> fd) {
 
   auto id = connections_.create(Connection());
   auto *conn = connections_.get(id);
+  conn->thread_index_ = get_connection_thread_index();
+  conn->relay_id_ = td::create_actor<WebhookConnectionRelay>(
+                        PSLICE() << "ConnectRelay:" << id,
+                        td::ActorShared<td::HttpOutboundConnection::Callback>(actor_id(this), id))
+                        .release();
   conn->actor_id_ = td::create_actor<td::HttpOutboundConnection>(
       PSLICE() << "Connect:" << id, std::move(fd), std::move(ssl_stream), 0, 50, 60,
-      td::ActorShared<td::HttpOutboundConnection::Callback>(actor_id(this), id),
-      SharedData::get_slow_outgoing_http_scheduler_id());
+      td::ActorShared<td::HttpOutboundConnection::Callback>(conn->relay_id_, 0),
+      SharedData::get_slow_outgoing_http_scheduler_id(conn->thread_index_));
+  add_connection(id);
+  VLOG(webhook) << "Create connection " << id;
+  return td::Status::OK();
+}
+
+td::int32 WebhookActor::get_connection_thread_index() const {
+  // place the connection on the thread with the least number of connections
+  td::int32 result = 0;
+  for (td::int32 i = 1; i < parameters_->webhook_thread_count_; i++) {
+    if (thread_connection_counts[i].load(std::memory_order_relaxed) <
+        thread_connection_counts[result].load(std::memory_order_relaxed)) {
+      result = i;
+    }
+  }
+  return result;
+}
+
+void WebhookActor::add_connection(td::uint64 id) {
+  auto *conn = connections_.get(id);
+  CHECK(conn != nullptr);
   conn->ip_generation_ = ip_generation_;
-  conn->event_id_ = {};
+  conn->event_ids_.clear();
   conn->id_ = id;
   ready_connections_.put(conn->to_list_node());
   total_connection_count_.fetch_add(1, std::memory_order_relaxed);
+  thread_connection_counts[conn->thread_index_].fetch_add(1, std::memory_order_relaxed);
 
   if (!was_checked_) {
     was_checked_ = true;
     on_webhook_verified();
   }
-  VLOG(webhook) << "Create connection " << id;
-  return td::Status::OK();
+}
+
+td::string WebhookActor::get_connection_pool_target() const {
+  if (!cert_path_.empty() || !ip_address_.is_valid()) {
+    // connections verified with a custom certificate aren't shared
+    return td::string();
+  }
+  return PSTRING() << (url_.protocol_ == td::HttpUrl::Protocol::Http ? "http" : "https") << '/' << ip_address_ << '/'
+                   << url_.host_;
+}
+
+bool WebhookActor::reuse_pooled_connection() {
+  auto target = get_connection_pool_target();
+  if (target.empty()) {
+    return false;
+  }
+  auto connection = parameters_->webhook_connection_pool_id_.get_actor_unsafe()->take_connection(target);
+  if (connection.connection_.empty()) {
+    return false;
+  }
+
+  auto id = connections_.create(Connection());
+  auto *conn = connections_.get(id);
+  conn->actor_id_ = std::move(connection.connection_);
+  conn->relay_id_ = connection.relay_id_;
+  conn->thread_index_ = connection.thread_index_;
+  send_closure(conn->relay_id_, &WebhookConnectionRelay::set_owner,
+               td::ActorShared<td::HttpOutboundConnection::Callback>(actor_id(this), id));
+  add_connection(id);
+  VLOG(webhook) << "Reuse connection " << id;
+  return true;
+}
+
+void WebhookActor::release_idle_connections(std::size_t keep_connection_count) {
+  auto target = get_connection_pool_target();
+  if (target.empty()) {
+    return;
+  }
+  while (connections_.size() > keep_connection_count && !ready_connections_.empty()) {
+    auto *conn = Connection::from_list_node(ready_connections_.get());
+    CHECK(conn->event_ids_.empty());
+    if (conn->ip_generation_ == ip_generation_) {
+      VLOG(webhook) << "Release connection " << conn->id_;
+      send_closure(parameters_->webhook_connection_pool_id_, &WebhookConnectionPool::put_connection, target,
+                   WebhookConnection{std::move(conn->actor_id_), conn->relay_id_, conn->thread_index_});
+    }
+    on_connection_removed(*conn);
+    connections_.erase(conn->id_);
+  }
+}
+
+void WebhookActor::on_connection_removed(const Connection &connection) {
+  total_connection_count_.fetch_sub(1, std::memory_order_relaxed);
+  thread_connection_counts[connection.thread_index_].fetch_sub(1, std::memory_order_relaxed);
 }
 
 void WebhookActor::on_socket_ready_async(td::Result<td::BufferedFd<td::SocketFd>> r_fd, td::int64 id) {
@@ -269,8 +375,8 @@ void WebhookActor::create_new_connections() {
   }
 
   size_t need_connections = queue_updates_.size();
-  if (need_connections > static_cast<size_t>(max_connections_)) {
-    need_connections = max_connections_;
+  if (need_connections > get_concurrency_limit()) {
+    need_connections = get_concurrency_limit();
   }
   if (!was_checked_) {
     need_connections = 1;
@@ -323,6 +429,49 @@ void WebhookActor::create_new_connections() {
   }
 }
 
+std::size_t WebhookActor::get_concurrency_limit() const {
+  return static_cast<std::size_t>(concurrency_limit_);
+}
+
+void WebhookActor::on_request_succeeded(double response_time) {
+  response_time = td::max(response_time, 0.0);
+  if (response_time_ewma_ == 0) {
+    response_time_ewma_ = response_time;
+    min_response_time_ = response_time;
+  } else {
+    response_time_ewma_ += (response_time - response_time_ewma_) * RESPONSE_TIME_EWMA_WEIGHT;
+    // let the minimum slowly follow the average to adapt to permanent changes of the endpoint
+    min_response_time_ += (response_time_ewma_ - min_response_time_) * MIN_RESPONSE_TIME_DRIFT;
+    min_response_time_ = td::min(min_response_time_, response_time);
+  }
+
+  if (response_time_ewma_ > min_response_time_ * MAX_RESPONSE_TIME_GROWTH + MIN_RESPONSE_TIME_SLACK) {
+    return decrease_concurrency_limit(LATENCY_CONCURRENCY_DECREASE_FACTOR, "response time growth");
+  }
+  if (active_request_count_ + 1 < get_concurrency_limit()) {
+    // the limit isn't reached, so there is no reason to increase it
+    return;
+  }
+  if (is_concurrency_slow_start_) {
+    concurrency_limit_ += 1.0;
+  } else {
+    concurrency_limit_ += 1.0 / concurrency_limit_;
+  }
+  concurrency_limit_ = td::min(concurrency_limit_, static_cast<double>(max_connections_));
+}
+
+void WebhookActor::decrease_concurrency_limit(double factor, td::Slice reason) {
+  is_concurrency_slow_start_ = false;
+  auto now = td::Time::now();
+  if (now < next_concurrency_decrease_time_) {
+    // responses to requests, which were sent before the previous decrease, must not decrease the limit again
+    return;
+  }
+  concurrency_limit_ = td::max(concurrency_limit_ * factor, 1.0);
+  next_concurrency_decrease_time_ = now + td::max(response_time_ewma_, MIN_RESPONSE_TIME_SLACK);
+  VLOG(webhook) << "Decrease concurrency limit to " << concurrency_limit_ << " because of " << reason;
+}
+
 void WebhookActor::loop() {
   VLOG(webhook) << "Enter loop";
   wakeup_at_ = 0;
@@ -338,6 +487,9 @@ void WebhookActor::loop() {
   if (!stop_flag_) {
     send_updates();
   }
+  if (!stop_flag_) {
+    clear_idle_latency_stats();
+  }
   if (!stop_flag_) {
     if (wakeup_at_ != 0) {
       set_timeout_at(wakeup_at_);
@@ -352,17 +504,46 @@ void WebhookActor::loop() {
 void WebhookActor::update() {
   VLOG(webhook) << "New updates in tqueue";
   tqueue_empty_ = false;
+  if (update_receive_times_.size() < MAX_TRACKED_RECEIVE_TIME_COUNT) {
+    update_receive_times_.push({parameters_->shared_data_->tqueue_->get_tail(tqueue_id_), td::Time::now()});
+  }
   loop();
 }
 
+bool WebhookActor::need_load_updates() const {
+  if (queue_updates_.size() >= max_loaded_queues_) {
+    return false;
+  }
+  // don't return to TQueue after each sent update if there are enough loaded updates
+  return update_map_.size() < MAX_LOADED_UPDATE_COUNT / 2 && loaded_update_size_ < get_max_loaded_update_size() / 2;
+}
+
+std::size_t WebhookActor::get_max_loaded_update_size() const {
+  if (total_loaded_update_size_.load(std::memory_order_relaxed) >= MAX_TOTAL_LOADED_UPDATE_SIZE) {
+    return MIN_LOADED_UPDATE_SIZE;
+  }
+  return MAX_LOADED_UPDATE_SIZE;
+}
+
+void WebhookActor::add_loaded_update_size(std::size_t size) {
+  loaded_update_size_ += size;
+  total_loaded_update_size_.fetch_add(size, std::memory_order_relaxed);
+}
+
+void WebhookActor::remove_loaded_update_size(std::size_t size) {
+  CHECK(loaded_update_size_ >= size);
+  loaded_update_size_ -= size;
+  total_loaded_update_size_.fetch_sub(size, std::memory_order_relaxed);
+}
+
 void WebhookActor::load_updates() {
   if (tqueue_empty_) {
     VLOG(webhook) << "Load updates: tqueue is empty";
     return;
   }
-  if (queue_updates_.size() >= max_loaded_updates_) {
-    CHECK(queue_updates_.size() == max_loaded_updates_);
-    VLOG(webhook) << "Load updates: maximum allowed number of updates is already loaded";
+  if (!need_load_updates()) {
+    VLOG(webhook) << "Load updates: enough updates are already loaded " << td::tag("queues", queue_updates_.size())
+                  << td::tag("updates", update_map_.size()) << td::tag("size", loaded_update_size_);
     return;
   }
   auto &tqueue = parameters_->shared_data_->tqueue_;
@@ -372,40 +553,53 @@ void WebhookActor::load_updates() {
   VLOG(webhook) << "Trying to load new updates from offset " << tqueue_offset_;
 
   auto offset = tqueue_offset_;
-  auto limit = td::min(SharedData::TQUEUE_EVENT_BUFFER_SIZE, max_loaded_updates_ - queue_updates_.size());
-  td::MutableSpan<td::TQueue::Event> updates(parameters_->shared_data_->event_buffer_, limit);
+  auto limit = td::min(TQueueEventBuffer::MAX_EVENT_COUNT, MAX_LOADED_UPDATE_COUNT - update_map_.size());
+  TQueueEventBuffer event_buffer(limit);
 
   auto now = td::Time::now();
   auto unix_time_now = parameters_->shared_data_->get_unix_time(now);
   size_t total_size = 0;
   if (offset.empty()) {
-    updates.truncate(0);
+    event_buffer.clear();
   } else {
-    auto r_size = tqueue->get(tqueue_id_, offset, false, unix_time_now, updates);
+    auto r_size = event_buffer.get(*tqueue, tqueue_id_, offset, false, unix_time_now);
     if (r_size.is_error()) {
       VLOG(webhook) << "Failed to get new updates: " << r_size.error();
       offset = tqueue_offset_ = tqueue->get_head(tqueue_id_);
-      r_size = tqueue->get(tqueue_id_, offset, false, unix_time_now, updates);
+      r_size = event_buffer.get(*tqueue, tqueue_id_, offset, false, unix_time_now);
       r_size.ensure();
     }
     total_size = r_size.ok();
   }
-  if (updates.empty()) {
+  auto &updates = event_buffer.events();
+  if (event_buffer.get_received_event_count() == 0) {
     tqueue_empty_ = true;
   }
 
+  std::size_t loaded_update_count = 0;
+  bool is_batch_loaded = true;
+  auto max_loaded_update_size = get_max_loaded_update_size();
   for (auto &update : updates) {
+    bool is_new_queue = update.extra == 0 || queue_updates_.count(update.extra) == 0;
+    if (loaded_update_size_ >= max_loaded_update_size ||
+        (is_new_queue && queue_updates_.size() >= max_loaded_queues_)) {
+      // the rest of updates will be loaded again later
+      is_batch_loaded = false;
+      break;
+    }
+    loaded_update_count++;
     VLOG(webhook) << "Load update " << update.id;
     CHECK(update.id.is_valid());
-    auto &dest_ptr = update_map_[update.id];
-    if (dest_ptr != nullptr) {
+    auto it = update_map_.emplace(update.id, Update());
+    if (!it.second) {
       LOG(ERROR) << "Receive duplicate event " << update.id << " from TQueue";
       continue;
     }
-    dest_ptr = td::make_unique<Update>();
-    auto &dest = *dest_ptr;
+    auto &dest = it.first->second;
     dest.id_ = update.id;
     dest.json_ = update.data.str();
+    dest.receive_time_ = get_update_receive_time(update.id, now);
+    add_loaded_update_size(dest.json_.size());
     dest.delay_ = 1;
     dest.wakeup_at_ = now;
     CHECK(update.expires_at >= unix_time_now);
@@ -419,10 +613,14 @@ void WebhookActor::load_updates() {
 
     auto &queue_updates = queue_updates_[dest.queue_id_];
     if (queue_updates.event_ids.empty()) {
-      queues_.emplace(dest.wakeup_at_, dest.queue_id_);
+      add_queue(dest.wakeup_at_, dest.queue_id_);
     }
     queue_updates.event_ids.push(dest.id_);
   }
+  if (is_batch_loaded && !event_buffer.get_next_event_id().empty()) {
+    // skip also the events, which failed to be unpacked
+    tqueue_offset_ = event_buffer.get_next_event_id();
+  }
 
   bool need_warning = false;
   if (total_size <= MIN_PENDING_UPDATES_WARNING / 2) {
@@ -437,13 +635,15 @@ void WebhookActor::load_updates() {
     }
   }
   if (need_warning) {
-    LOG(WARNING) << "Loaded " << updates.size() << " updates out of " << total_size << ". Have " << update_map_.size()
-                 << " updates loaded in " << queue_updates_.size() << " queues after last error \""
-                 << last_error_message_ << "\" " << (last_error_time_ == 0 ? -1 : td::Time::now() - last_error_time_)
-                 << " seconds ago";
+    LOG(WARNING) << "Loaded " << loaded_update_count << " updates out of " << total_size << ". Have "
+                 << update_map_.size() << " updates loaded in " << queue_updates_.size()
+                 << " queues after last error \"" << last_error_message_ << "\" "
+                 << (last_error_time_ == 0 ? -1 : td::Time::now() - last_error_time_) << " seconds ago";
   }
 
-  if (updates.size() == total_size && last_update_was_successful_) {
+  // all pending updates are loaded only if the request returned all of them and none of them were left in TQueue
+  bool is_queue_drained = is_batch_loaded && event_buffer.get_received_event_count() >= total_size;
+  if (is_queue_drained && last_update_was_successful_) {
     send_closure(callback_, &Callback::webhook_success);
   }
 
@@ -454,10 +654,57 @@ void WebhookActor::load_updates() {
   }
 }
 
+void WebhookActor::add_queue(double wakeup_at, td::int64 queue_id) {
+  queues_.emplace_back(wakeup_at, queue_id);
+  std::push_heap(queues_.begin(), queues_.end(), std::greater<Queue>());
+}
+
+void WebhookActor::pop_first_queue() {
+  CHECK(!queues_.empty());
+  std::pop_heap(queues_.begin(), queues_.end(), std::greater<Queue>());
+  queues_.pop_back();
+}
+
+const WebhookLatencyStats &WebhookActor::get_global_latency_stats() {
+  return global_latency_stats;
+}
+
+void WebhookActor::add_latency(LatencyHistogram WebhookLatencyStats::*histogram, double duration) {
+  ((*latency_stats_).*histogram).add(duration);
+  latency_stats_->last_add_time_ = td::Time::now();
+  (global_latency_stats.*histogram).add(duration);
+}
+
+void WebhookActor::clear_idle_latency_stats() {
+  if (latency_stats_->empty()) {
+    return;
+  }
+  auto clear_at = latency_stats_->last_add_time_ + LATENCY_STATS_IDLE_TIMEOUT;
+  if (clear_at > td::Time::now()) {
+    relax_wakeup_at(clear_at, "clear_idle_latency_stats");
+    return;
+  }
+  VLOG(webhook) << "Clear latency statistics of the idle webhook";
+  latency_stats_->clear();
+}
+
+double WebhookActor::get_update_receive_time(td::TQueue::EventId event_id, double now) {
+  // the update was received before the first notification about updates after it;
+  // updates, which were added before the actor was started, are considered received when they are loaded
+  while (!update_receive_times_.empty() && update_receive_times_.front().first.value() <= event_id.value()) {
+    update_receive_times_.pop();
+  }
+  if (update_receive_times_.empty()) {
+    return now;
+  }
+  return td::min(update_receive_times_.front().second, now);
+}
+
 void WebhookActor::drop_event(td::TQueue::EventId event_id) {
   auto it = update_map_.find(event_id);
   CHECK(it != update_map_.end());
-  auto queue_id = it->second->queue_id_;
+  auto queue_id = it->second.queue_id_;
+  remove_loaded_update_size(it->second.json_.size());
   update_map_.erase(it);
 
   auto queue_updates_it = queue_updates_.find(queue_id);
@@ -470,8 +717,9 @@ void WebhookActor::drop_event(td::TQueue::EventId event_id) {
   } else {
     auto update_id = queue_updates_it->second.event_ids.front();
     CHECK(update_id.is_valid());
-    auto &update = update_map_[update_id];
-    queues_.emplace(update->wakeup_at_, update->queue_id_);
+    auto update_it = update_map_.find(update_id);
+    CHECK(update_it != update_map_.end());
+    add_queue(update_it->second.wakeup_at_, update_it->second.queue_id_);
   }
 
   parameters_->shared_data_->tqueue_->forget(tqueue_id_, event_id);
@@ -484,8 +732,10 @@ void WebhookActor::on_update_ok(td::TQueue::EventId event_id) {
   auto it = update_map_.find(event_id);
   CHECK(it != update_map_.end());
 
-  VLOG(webhook) << "Receive ok for update " << event_id << " in " << (last_success_time_ - it->second->last_send_time_)
+  VLOG(webhook) << "Receive ok for update " << event_id << " in " << (last_success_time_ - it->second.last_send_time_)
                 << " seconds";
+  add_latency(&WebhookLatencyStats::response_, last_success_time_ - it->second.last_send_time_);
+  add_latency(&WebhookLatencyStats::delivery_, last_success_time_ - it->second.receive_time_);
 
   drop_event(event_id);
 }
@@ -496,10 +746,8 @@ void WebhookActor::on_update_error(td::TQueue::EventId event_id, td::Slice error
 
   auto it = update_map_.find(event_id);
   CHECK(it != update_map_.end());
-  CHECK(it->second != nullptr);
-  auto &update = *it->second;
+  auto &update = it->second;
 
-  const int MAX_RETRY_AFTER = 3600;
   retry_after = td::clamp(retry_after, 0, MAX_RETRY_AFTER);
   int next_delay = update.delay_;
   int next_effective_delay = retry_after;
@@ -516,12 +764,57 @@ void WebhookActor::on_update_error(td::TQueue::EventId event_id, td::Slice error
   update.delay_ = next_delay;
   update.wakeup_at_ = now + next_effective_delay;
   update.fail_count_++;
-  queues_.emplace(update.wakeup_at_, update.queue_id_);
+  add_queue(update.wakeup_at_, update.queue_id_);
   VLOG(webhook) << "Delay update " << event_id << " for " << (update.wakeup_at_ - now) << " seconds because of "
                 << error << " after " << update.fail_count_ << " fails received in " << (now - update.last_send_time_)
                 << " seconds";
 }
 
+class JsonWebhookUpdates final : public td::Jsonable {
+ public:
+  explicit JsonWebhookUpdates(td::Span<std::pair<td::int32, td::Slice>> updates) : updates_(updates) {
+  }
+  void store(td::JsonValueScope *scope) const {
+    auto array = scope->enter_array();
+    for (auto &update : updates_) {
+      array << JsonUpdate(update.first, update.second);
+    }
+  }
+
+ private:
+  td::Span<std::pair<td::int32, td::Slice>> updates_;
+};
+
+static td::Result<td::string> create_webhook_request_header(const td::HttpUrl &url, td::Slice host_header,
+                                                           td::Slice secret_token, std::size_t content_size,
+                                                           bool is_gzipped) {
+  td::HttpHeaderCreator hc;
+  hc.init_post(url.query_);
+  hc.add_header("Host", host_header);
+  if (!url.userinfo_.empty()) {
+    hc.add_header("Authorization", PSLICE() << "Basic " << td::base64_encode(url.userinfo_));
+  }
+  if (!secret_token.empty()) {
+    hc.add_header("X-Telegram-Bot-Api-Secret-Token", secret_token);
+  }
+  hc.set_content_type("application/json");
+  if (is_gzipped) {
+    hc.add_header("Content-Encoding", "gzip");
+  }
+  hc.set_content_size(content_size);
+  hc.set_keep_alive();
+  hc.add_header("Accept-Encoding", "gzip, deflate");
+  TRY_RESULT(header, hc.finish());
+  return header.str();
+}
+
+static void send_webhook_request(td::ActorId<td::HttpOutboundConnection> connection_id, td::string header,
+                                 td::BufferSlice body) {
+  send_closure(connection_id, &td::HttpOutboundConnection::write_next_noflush, td::BufferSlice(header));
+  send_closure(connection_id, &td::HttpOutboundConnection::write_next_noflush, std::move(body));
+  send_closure(connection_id, &td::HttpOutboundConnection::write_ok);
+}
+
 td::Status WebhookActor::send_update() {
   if (ready_connections_.empty()) {
     return td::Status::Error("No connection");
@@ -530,55 +823,109 @@ td::Status WebhookActor::send_update() {
   if (queues_.empty()) {
     return td::Status::Error("No pending updates");
   }
-  auto it = queues_.begin();
+  if (active_request_count_ >= get_concurrency_limit()) {
+    return td::Status::Error("Too many active requests");
+  }
   auto now = td::Time::now();
-  if (it->wakeup_at > now) {
-    relax_wakeup_at(it->wakeup_at, "send_update");
+  if (retry_after_time_ > now) {
+    relax_wakeup_at(retry_after_time_, "send_update retry_after");
+    return td::Status::Error("Retry later");
+  }
+  if (queues_[0].wakeup_at > now) {
+    relax_wakeup_at(queues_[0].wakeup_at, "send_update");
     return td::Status::Error("No ready updates");
   }
 
-  auto queue_id = it->id;
-  CHECK(queue_id != 0);
-  queues_.erase(it);
-  auto event_id = queue_updates_[queue_id].event_ids.front();
-  CHECK(event_id.is_valid());
+  td::vector<Update *> updates;
+  std::size_t total_size = 0;
+  while (true) {
+    auto queue_id = queues_[0].id;
+    CHECK(queue_id != 0);
+    auto event_id = queue_updates_[queue_id].event_ids.front();
+    CHECK(event_id.is_valid());
 
-  auto update_map_it = update_map_.find(event_id);
-  CHECK(update_map_it != update_map_.end());
-  CHECK(update_map_it->second != nullptr);
-  auto &update = *update_map_it->second;
-  update.last_send_time_ = now;
-
-  auto body = td::json_encode<td::BufferSlice>(JsonUpdate(update.id_.value(), update.json_));
+    auto update_map_it = update_map_.find(event_id);
+    CHECK(update_map_it != update_map_.end());
+    auto &update = update_map_it->second;
+    if (!updates.empty() && update.fail_count_ > 0) {
+      // updates, which failed to be sent, are resent one by one
+      break;
+    }
 
-  td::HttpHeaderCreator hc;
-  hc.init_post(url_.query_);
-  hc.add_header("Host", host_header_);
-  if (!url_.userinfo_.empty()) {
-    hc.add_header("Authorization", PSLICE() << "Basic " << td::base64_encode(url_.userinfo_));
+    pop_first_queue();
+    if (update.last_send_time_ == 0) {
+      add_latency(&WebhookLatencyStats::first_send_, now - update.receive_time_);
+    }
+    update.last_send_time_ = now;
+    updates.push_back(&update);
+    total_size += update.json_.size();
+    if (update.fail_count_ > 0 || updates.size() >= static_cast<std::size_t>(batch_size_) ||
+        total_size >= MAX_BATCH_BODY_SIZE || queues_.empty()) {
+      break;
+    }
+    if (queues_[0].wakeup_at > now) {
+      break;
+    }
   }
-  if (!secret_token_.empty()) {
-    hc.add_header("X-Telegram-Bot-Api-Secret-Token", secret_token_);
+
+  td::BufferSlice body;
+  if (batch_size_ == 1) {
+    CHECK(updates.size() == 1);
+    body = td::json_encode<td::BufferSlice>(JsonUpdate(updates[0]->id_.value(), updates[0]->json_));
+  } else {
+    td::vector<std::pair<td::int32, td::Slice>> json_updates;
+    json_updates.reserve(updates.size());
+    for (auto *update : updates) {
+      json_updates.emplace_back(update->id_.value(), update->json_);
+    }
+    body = td::json_encode<td::BufferSlice>(JsonWebhookUpdates(json_updates));
   }
-  hc.set_content_type("application/json");
-  hc.set_content_size(body.size());
-  hc.set_keep_alive();
-  hc.add_header("Accept-Encoding", "gzip, deflate");
-  auto r_header = hc.finish();
+
+  bool need_compression = false;
+#if TD_HAVE_ZLIB
+  need_compression = parameters_->webhook_compression_threshold_ > 0 &&
+                     body.size() >= static_cast<std::size_t>(parameters_->webhook_compression_threshold_);
+#endif
+  // the header with Content-Encoding can't be shorter than the header for a compressed body
+  auto r_header = create_webhook_request_header(url_, host_header_, secret_token_, body.size(), need_compression);
   if (r_header.is_error()) {
     return td::Status::Error(400, "URL is too long");
   }
 
   auto &connection = *Connection::from_list_node(ready_connections_.get());
-  connection.event_id_ = update.id_;
+  CHECK(connection.event_ids_.empty());
+  for (auto *update : updates) {
+    VLOG(webhook) << "Send update " << update->id_ << " from queue " << update->queue_id_ << " into connection "
+                  << connection.id_ << ": " << update->json_;
+    connection.event_ids_.push_back(update->id_);
+  }
+  connection.send_time_ = now;
+  active_request_count_++;
+
+  if (need_compression) {
+    // compress the body on the connection's thread to keep the actor responsive
+    td::Scheduler::instance()->run_on_scheduler(
+        SharedData::get_slow_outgoing_http_scheduler_id(connection.thread_index_),
+        [connection_id = connection.actor_id_.get(), url = url_, host_header = host_header_,
+         secret_token = secret_token_, body = std::move(body)](td::Unit) mutable {
+          td::BufferSlice compressed_body;
+#if TD_HAVE_ZLIB
+          compressed_body = td::gzencode(body.as_slice(), 0.9);
+#endif
+          bool is_gzipped = !compressed_body.empty();
+          if (is_gzipped) {
+            body = std::move(compressed_body);
+          }
+          auto r_header = create_webhook_request_header(url, host_header, secret_token, body.size(), is_gzipped);
+          LOG_CHECK(r_header.is_ok()) << r_header.error();
+          VLOG(webhook) << "Request headers: " << r_header.ok();
+          send_webhook_request(connection_id, r_header.move_as_ok(), std::move(body));
+        });
+    return td::Status::OK();
+  }
 
-  VLOG(webhook) << "Send update " << update.id_ << " from queue " << queue_id << " into connection " << connection.id_
-                << ": " << update.json_;
   VLOG(webhook) << "Request headers: " << r_header.ok();
-
-  send_closure(connection.actor_id_, &td::HttpOutboundConnection::write_next_noflush, td::BufferSlice(r_header.ok()));
-  send_closure(connection.actor_id_, &td::HttpOutboundConnection::write_next_noflush, std::move(body));
-  send_closure(connection.actor_id_, &td::HttpOutboundConnection::write_ok);
+  send_webhook_request(connection.actor_id_.get(), r_header.move_as_ok(), std::move(body));
   return td::Status::OK();
 }
 
@@ -587,6 +934,10 @@ void WebhookActor::send_updates() {
                 << queues_.size() << " queues to send";
   while (send_update().is_ok()) {
   }
+  if (update_map_.empty()) {
+    // share connections, which aren't needed now, with other webhooks to the same host
+    release_idle_connections(1);
+  }
 }
 
 void WebhookActor::handle(td::unique_ptr<td::HttpQuery> response) {
@@ -609,6 +960,7 @@ void WebhookActor::handle(td::unique_ptr<td::HttpQuery> response) {
   td::string query_error;
   td::int32 retry_after = 0;
   bool need_close = false;
+  bool is_overloaded = false;
 
   if (response) {
     if (response->type_ != td::HttpQuery::Type::Response || !response->keep_alive_ ||
@@ -647,36 +999,53 @@ void WebhookActor::handle(td::unique_ptr<td::HttpQuery> response) {
           first_error_410_time_ = 0;
         }
         retry_after = response->get_retry_after();
+        is_overloaded = response->code_ == 429 || response->code_ >= 500;
         // LOG(WARNING) << query_error;
         on_webhook_error(query_error);
       }
     } else {
       query_error = PSTRING() << "Wrong response from the webhook: " << *response;
+      is_overloaded = true;
       on_webhook_error(query_error);
     }
     VLOG(webhook) << *response;
   } else {
     query_error = "Webhook connection closed";
+    is_overloaded = true;
     connection_ptr->actor_id_.release();
     close_connection = true;
   }
 
-  auto event_id = connection_ptr->event_id_;
-  if (!event_id.empty()) {
+  auto event_ids = std::move(connection_ptr->event_ids_);
+  connection_ptr->event_ids_.clear();
+  if (!event_ids.empty()) {
+    CHECK(active_request_count_ > 0);
+    active_request_count_--;
     if (query_error.empty()) {
-      on_update_ok(event_id);
-    } else {
-      on_update_error(event_id, query_error, retry_after);
+      on_request_succeeded(td::Time::now() - connection_ptr->send_time_);
+    } else if (is_overloaded) {
+      decrease_concurrency_limit(OVERLOAD_CONCURRENCY_DECREASE_FACTOR, query_error);
+    }
+    if (retry_after > 0) {
+      // Retry-After applies to the whole endpoint and not only to the updates from the failed request
+      retry_after_time_ = td::max(retry_after_time_, td::Time::now() + td::min(retry_after, MAX_RETRY_AFTER));
+    }
+
+    for (auto event_id : event_ids) {
+      if (query_error.empty()) {
+        on_update_ok(event_id);
+      } else {
+        on_update_error(event_id, query_error, retry_after);
+      }
     }
   } else {
     CHECK(!query_error.empty());
   }
 
-  connection_ptr->event_id_ = {};
   if (need_close || close_connection) {
     VLOG(webhook) << "Close connection " << connection_id;
+    on_connection_removed(*connection_ptr);
     connections_.erase(connection_ptr->id_);
-    total_connection_count_.fetch_sub(1, std::memory_order_relaxed);
   } else {
     ready_connections_.put(connection_ptr->to_list_node());
   }
@@ -689,7 +1058,7 @@ void WebhookActor::handle(td::unique_ptr<td::HttpQuery> response) {
 }
 
 void WebhookActor::start_up() {
-  max_loaded_updates_ = max_connections_ * 2;
+  max_loaded_queues_ = max_connections_ * batch_size_ * 2;
 
   last_success_time_ = td::Time::now() - 2 * IP_ADDRESS_CACHE_TIME;
   if (from_db_flag_) {
@@ -758,7 +1127,11 @@ void WebhookActor::close() {
 }
 
 void WebhookActor::tear_down() {
-  total_connection_count_.fetch_sub(connections_.size(), std::memory_order_relaxed);
+  remove_loaded_update_size(loaded_update_size_);
+  release_idle_connections(0);
+  for (auto id : connections_.ids()) {
+    on_connection_removed(*connections_.get(id));
+  }
 }
 
 void WebhookActor::on_webhook_verified() {
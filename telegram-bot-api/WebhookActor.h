@@ -7,6 +7,8 @@
 #pragma once
 
 #include "telegram-bot-api/Query.h"
+#include "telegram-bot-api/Stats.h"
+#include "telegram-bot-api/WebhookConnectionPool.h"
 
 #include "td/db/TQueue.h"
 
@@ -34,7 +36,6 @@
 
 #include <atomic>
 #include <memory>
-#include <set>
 #include <tuple>
 
 namespace telegram_bot_api {
@@ -53,8 +54,9 @@ class WebhookActor final : public td::HttpOutboundConnection::Callback {
   };
 
   WebhookActor(td::ActorShared<Callback> callback, td::int64 tqueue_id, td::HttpUrl url, td::string cert_path,
-               td::int32 max_connections, bool from_db_flag, td::string cached_ip_address, bool fix_ip_address,
-               td::string secret_token, std::shared_ptr<const ClientParameters> parameters);
+               td::int32 max_connections, td::int32 batch_size, bool from_db_flag, td::string cached_ip_address,
+               bool fix_ip_address, td::string secret_token, std::shared_ptr<WebhookLatencyStats> latency_stats,
+               std::shared_ptr<const ClientParameters> parameters);
   WebhookActor(const WebhookActor &) = delete;
   WebhookActor &operator=(const WebhookActor &) = delete;
   WebhookActor(WebhookActor &&) = delete;
@@ -65,17 +67,56 @@ class WebhookActor final : public td::HttpOutboundConnection::Callback {
 
   void close();
 
+  std::size_t get_connection_count() const {
+    return connections_.size();
+  }
+
+  std::size_t get_active_request_count() const {
+    return active_request_count_;
+  }
+
   static td::int64 get_total_connection_count() {
     return total_connection_count_;
   }
 
+  static td::vector<td::uint64> get_thread_connection_counts(td::int32 thread_count);
+
+  // aggregated statistics of all webhooks; must be used only from the client scheduler
+  static const WebhookLatencyStats &get_global_latency_stats();
+
  private:
   static constexpr std::size_t MIN_PENDING_UPDATES_WARNING = 50;
   static constexpr td::int32 IP_ADDRESS_CACHE_TIME = 30 * 60;  // 30 minutes
   static constexpr td::int32 WEBHOOK_MAX_RESEND_TIMEOUT = 60;
   static constexpr td::int32 WEBHOOK_DROP_TIMEOUT = 60 * 60 * 23;
+  static constexpr td::int32 MAX_RETRY_AFTER = 3600;
+  static constexpr std::size_t MAX_BATCH_BODY_SIZE = 1 << 20;
+
+  // besides the number of queues, which can be sent in parallel, the number of prefetched updates is limited only by
+  // their number and total size; new updates are loaded only after at least a half of them are sent
+  static constexpr std::size_t MAX_LOADED_UPDATE_COUNT = 1000;
+  static constexpr std::size_t MAX_LOADED_UPDATE_SIZE = 1 << 20;
+
+  // total size of updates prefetched by all webhooks; after it is exceeded, each webhook can load updates only while
+  // it has less than MIN_LOADED_UPDATE_SIZE bytes of them loaded
+  static constexpr std::size_t MAX_TOTAL_LOADED_UPDATE_SIZE = static_cast<std::size_t>(1) << 28;
+  static constexpr std::size_t MIN_LOADED_UPDATE_SIZE = 1 << 16;
+  static constexpr std::size_t MAX_TRACKED_RECEIVE_TIME_COUNT = 10000;
+
+  // latency histograms of the webhook are dropped if no updates were sent for this time; the aggregated ones are kept
+  static constexpr double LATENCY_STATS_IDLE_TIMEOUT = 60 * 60;
+
+  // the number of simultaneous requests is controlled by AIMD with slow start; besides errors, a sustained growth of
+  // the response time compared to the minimum observed one is treated as a sign of endpoint overload
+  static constexpr double RESPONSE_TIME_EWMA_WEIGHT = 0.2;
+  static constexpr double MIN_RESPONSE_TIME_DRIFT = 0.01;
+  static constexpr double MAX_RESPONSE_TIME_GROWTH = 2.0;
+  static constexpr double MIN_RESPONSE_TIME_SLACK = 0.05;
+  static constexpr double OVERLOAD_CONCURRENCY_DECREASE_FACTOR = 0.5;
+  static constexpr double LATENCY_CONCURRENCY_DECREASE_FACTOR = 0.9;
 
   static std::atomic<td::uint64> total_connection_count_;
+  static std::atomic<std::size_t> total_loaded_update_size_;
 
   td::ActorShared<Callback> callback_;
   const td::int64 tqueue_id_;
@@ -102,6 +143,7 @@ class WebhookActor final : public td::HttpOutboundConnection::Callback {
     td::TQueue::EventId id_;
     td::string json_;
     td::int32 expires_at_ = 0;
+    double receive_time_ = 0;
     double last_send_time_ = 0;
     double wakeup_at_ = 0;
     int delay_ = 0;
@@ -125,18 +167,22 @@ class WebhookActor final : public td::HttpOutboundConnection::Callback {
     bool operator<(const Queue &other) const {
       return std::tie(integer_wakeup_at, id) < std::tie(other.integer_wakeup_at, other.id);
     }
+    bool operator>(const Queue &other) const {
+      return other < *this;
+    }
   };
 
   td::TQueue::EventId tqueue_offset_;
-  std::size_t max_loaded_updates_ = 0;
+  std::size_t max_loaded_queues_ = 0;
+  std::size_t loaded_update_size_ = 0;
   struct EventIdHash {
     td::uint32 operator()(td::TQueue::EventId event_id) const {
       return td::Hash<td::int32>()(event_id.value());
     }
   };
-  td::FlatHashMap<td::TQueue::EventId, td::unique_ptr<Update>, EventIdHash> update_map_;
+  td::FlatHashMap<td::TQueue::EventId, Update, EventIdHash> update_map_;
   td::FlatHashMap<td::int64, QueueUpdates> queue_updates_;
-  std::set<Queue> queues_;
+  td::vector<Queue> queues_;  // binary heap with the queue to be woken up first at the top
   td::int64 unique_queue_id_ = static_cast<td::int64>(1) << 60;
 
   double first_error_410_time_ = 0;
@@ -157,8 +203,11 @@ class WebhookActor final : public td::HttpOutboundConnection::Callback {
     ~Connection() = default;
 
     td::ActorOwn<td::HttpOutboundConnection> actor_id_;
+    td::ActorId<WebhookConnectionRelay> relay_id_;
+    td::int32 thread_index_ = 0;
     td::uint64 id_ = 0;
-    td::TQueue::EventId event_id_;
+    td::vector<td::TQueue::EventId> event_ids_;
+    double send_time_ = 0;
     td::int32 ip_generation_ = -1;
     static Connection *from_list_node(ListNode *node) {
       return static_cast<Connection *>(node);
@@ -171,7 +220,11 @@ class WebhookActor final : public td::HttpOutboundConnection::Callback {
   td::vector<td::BufferedFd<td::SocketFd>> ready_sockets_;
 
   const td::int32 max_connections_ = 0;
+  const td::int32 batch_size_ = 1;
   const td::string secret_token_;
+  std::shared_ptr<WebhookLatencyStats> latency_stats_;
+  // pairs of the next TQueue event identifier and the time when the actor was notified about new updates before it
+  td::VectorQueue<std::pair<td::TQueue::EventId, double>> update_receive_times_;
   td::Container<Connection> connections_;
   td::ListNode ready_connections_;
   td::FloodControlFast active_new_connection_flood_;
@@ -180,6 +233,14 @@ class WebhookActor final : public td::HttpOutboundConnection::Callback {
   double wakeup_at_ = 0;
   bool last_update_was_successful_ = true;
 
+  double concurrency_limit_ = 1.0;
+  bool is_concurrency_slow_start_ = true;
+  double next_concurrency_decrease_time_ = 0;
+  std::size_t active_request_count_ = 0;
+  double response_time_ewma_ = 0;
+  double min_response_time_ = 0;
+  double retry_after_time_ = 0;  // no requests are sent to the endpoint until the time, requested by Retry-After
+
   void relax_wakeup_at(double wakeup_at, const char *source);
 
   void resolve_ip_address();
@@ -192,12 +253,34 @@ class WebhookActor final : public td::HttpOutboundConnection::Callback {
   td::Result<td::SslStream> create_ssl_stream();
   td::Status create_connection() TD_WARN_UNUSED_RESULT;
   td::Status create_connection(td::BufferedFd<td::SocketFd> fd) TD_WARN_UNUSED_RESULT;
+  td::int32 get_connection_thread_index() const;
+  void add_connection(td::uint64 id);
+  static void on_connection_removed(const Connection &connection);
+  td::string get_connection_pool_target() const;
+  bool reuse_pooled_connection();
+  void release_idle_connections(std::size_t keep_connection_count);
   void on_socket_ready_async(td::Result<td::BufferedFd<td::SocketFd>> r_fd, td::int64 id);
 
   void create_new_connections();
 
+  std::size_t get_concurrency_limit() const;
+  void on_request_succeeded(double response_time);
+  void decrease_concurrency_limit(double factor, td::Slice reason);
+
+  void add_queue(double wakeup_at, td::int64 queue_id);
+  void pop_first_queue();
+
   void drop_event(td::TQueue::EventId event_id);
 
+  void add_latency(LatencyHistogram WebhookLatencyStats::*histogram, double duration);
+
+  void clear_idle_latency_stats();
+  double get_update_receive_time(td::TQueue::EventId event_id, double now);
+
+  bool need_load_updates() const;
+  std::size_t get_max_loaded_update_size() const;
+  void add_loaded_update_size(std::size_t size);
+  void remove_loaded_update_size(std::size_t size);
   void load_updates();
   void on_update_ok(td::TQueue::EventId event_id);
   void on_update_error(td::TQueue::EventId event_id, td::Slice error, int retry_after);
@@ -225,12 +308,13 @@ class WebhookActor final : public td::HttpOutboundConnection::Callback {
 
 class JsonUpdate final : public td::Jsonable {
  public:
-  JsonUpdate(td::int32 id, td::Slice update) : id_(id), update_(update) {
+  JsonUpdate(td::int32 id, td::Slice update, bool is_single_line = false)
+      : id_(id), update_(update), is_single_line_(is_single_line) {
   }
   void store(td::JsonValueScope *scope) const {
     auto object = scope->enter_object();
     object("update_id", id_);
-    object << td::JsonRaw(",\n");
+    object << td::JsonRaw(is_single_line_ ? td::Slice(",") : td::Slice(",\n"));
     CHECK(!update_.empty());
     object << td::JsonRaw(update_);
   }
@@ -238,6 +322,7 @@ class JsonUpdate final : public td::Jsonable {
  private:
   td::int32 id_;
   td::Slice update_;
+  bool is_single_line_;
 };
 
 }  // namespace telegram_bot_api
@@ -0,0 +1,95 @@
+//
+// Copyright Aliaksei Levin (levlam@telegram.org), Arseny Smirnov (arseny30@gmail.com) 2014-2025
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#include "telegram-bot-api/WebhookConfig.h"
+
+#include "td/utils/misc.h"
+#include "td/utils/Parser.h"
+#include "td/utils/SliceBuilder.h"
+
+namespace telegram_bot_api {
+
+static td::string serialize_text_webhook_config(const WebhookConfig &config) {
+  td::string value;
+  if (config.has_certificate_) {
+    value += "cert/";
+  }
+  value += PSTRING() << "#maxc" << config.max_connections_ << '/';
+  if (!config.ip_address_.empty()) {
+    value += PSTRING() << "#ip" << config.ip_address_ << '/';
+  }
+  if (config.fix_ip_address_) {
+    value += "#fix_ip/";
+  }
+  if (!config.secret_token_.empty()) {
+    value += PSTRING() << "#secret" << config.secret_token_ << '/';
+  }
+  if (config.allowed_update_types_ != 0) {
+    value += PSTRING() << "#allow" << config.allowed_update_types_ << '/';
+  }
+  value += config.url_;
+  return value;
+}
+
+td::string serialize_webhook_config(const WebhookConfig &config) {
+  if (config.batch_size_ <= 1) {
+    // the old format is used whenever possible to keep webhooks_db readable by previous server versions
+    return serialize_text_webhook_config(config);
+  }
+  return td::serialize(config);
+}
+
+static td::Result<WebhookConfig> parse_text_webhook_config(td::Slice value) {
+  WebhookConfig config;
+  td::ConstParser parser(value);
+  if (parser.try_skip("cert/")) {
+    config.has_certificate_ = true;
+  }
+
+  if (parser.try_skip("#maxc")) {
+    config.max_connections_ = td::to_integer<td::int32>(parser.read_till('/'));
+    parser.skip('/');
+  }
+
+  if (parser.try_skip("#ip")) {
+    config.ip_address_ = parser.read_till('/').str();
+    parser.skip('/');
+  }
+
+  if (parser.try_skip("#fix_ip")) {
+    config.fix_ip_address_ = true;
+    parser.skip('/');
+  }
+
+  if (parser.try_skip("#secret")) {
+    config.secret_token_ = parser.read_till('/').str();
+    parser.skip('/');
+  }
+
+  if (parser.try_skip("#allow")) {
+    config.allowed_update_types_ = td::to_integer<td::uint32>(parser.read_till('/'));
+    parser.skip('/');
+  }
+
+  config.url_ = parser.read_all().str();
+  TRY_STATUS(std::move(parser.status()));
+  return std::move(config);
+}
+
+td::Result<WebhookConfig> parse_webhook_config(td::Slice value) {
+  if (value.empty()) {
+    return td::Status::Error("Empty webhook config");
+  }
+  if (static_cast<unsigned char>(value[0]) >= static_cast<unsigned char>(' ')) {
+    return parse_text_webhook_config(value);
+  }
+
+  WebhookConfig config;
+  TRY_STATUS(td::unserialize(config, value));
+  return std::move(config);
+}
+
+}  // namespace telegram_bot_api
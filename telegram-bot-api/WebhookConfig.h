@@ -0,0 +1,109 @@
+//
+// Copyright Aliaksei Levin (levlam@telegram.org), Arseny Smirnov (arseny30@gmail.com) 2014-2025
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#pragma once
+
+#include "td/utils/common.h"
+#include "td/utils/Slice.h"
+#include "td/utils/Status.h"
+#include "td/utils/tl_helpers.h"
+
+namespace telegram_bot_api {
+
+// Webhook parameters, which are saved in webhooks_db and used to restore the webhook after restart
+struct WebhookConfig {
+  td::string url_;
+  td::int32 max_connections_ = 0;
+  td::string ip_address_;
+  bool fix_ip_address_ = false;
+  td::string secret_token_;
+  td::uint32 allowed_update_types_ = 0;  // 0 if unchanged
+  bool has_certificate_ = false;
+  td::int32 batch_size_ = 1;
+
+  // must be less than ' ' to distinguish serialized configs from the old text format
+  static constexpr td::int32 CURRENT_VERSION = 2;
+
+  template <class StorerT>
+  void store(StorerT &storer) const {
+    using td::store;
+    bool has_ip_address = !ip_address_.empty();
+    bool has_secret_token = !secret_token_.empty();
+    bool has_allowed_update_types = allowed_update_types_ != 0;
+    bool has_batch_size = batch_size_ > 1;
+    store(CURRENT_VERSION, storer);
+    BEGIN_STORE_FLAGS();
+    STORE_FLAG(has_certificate_);
+    STORE_FLAG(fix_ip_address_);
+    STORE_FLAG(has_ip_address);
+    STORE_FLAG(has_secret_token);
+    STORE_FLAG(has_allowed_update_types);
+    STORE_FLAG(has_batch_size);
+    END_STORE_FLAGS();
+    store(url_, storer);
+    store(max_connections_, storer);
+    if (has_ip_address) {
+      store(ip_address_, storer);
+    }
+    if (has_secret_token) {
+      store(secret_token_, storer);
+    }
+    if (has_allowed_update_types) {
+      store(allowed_update_types_, storer);
+    }
+    if (has_batch_size) {
+      store(batch_size_, storer);
+    }
+  }
+
+  template <class ParserT>
+  void parse(ParserT &parser) {
+    using td::parse;
+    td::int32 version;
+    parse(version, parser);
+    if (version <= 0 || version > CURRENT_VERSION) {
+      return parser.set_error("Unsupported webhook config version");
+    }
+    bool has_ip_address;
+    bool has_secret_token;
+    bool has_allowed_update_types;
+    bool has_batch_size = false;
+    BEGIN_PARSE_FLAGS();
+    PARSE_FLAG(has_certificate_);
+    PARSE_FLAG(fix_ip_address_);
+    PARSE_FLAG(has_ip_address);
+    PARSE_FLAG(has_secret_token);
+    PARSE_FLAG(has_allowed_update_types);
+    if (version >= 2) {
+      PARSE_FLAG(has_batch_size);
+    }
+    END_PARSE_FLAGS();
+    parse(url_, parser);
+    parse(max_connections_, parser);
+    if (has_ip_address) {
+      parse(ip_address_, parser);
+    }
+    if (has_secret_token) {
+      parse(secret_token_, parser);
+    }
+    if (has_allowed_update_types) {
+      parse(allowed_update_types_, parser);
+    }
+    if (has_batch_size) {
+      parse(batch_size_, parser);
+    }
+  }
+};
+
+// Configs, which can be represented in the old text format, are stored in it, so previous server versions can still
+// restore them after a downgrade. Configs with new parameters are stored in the binary format, which can't be read
+// by server versions before the introduction of the format, so such webhooks are lost after a downgrade.
+td::string serialize_webhook_config(const WebhookConfig &config);
+
+// supports both the current binary format and the old "cert/#maxc40/#ip1.2.3.4/#fix_ip/#secret.../#allow.../url"
+td::Result<WebhookConfig> parse_webhook_config(td::Slice value);
+
+}  // namespace telegram_bot_api
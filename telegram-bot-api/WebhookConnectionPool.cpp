@@ -0,0 +1,106 @@
+//
+// Copyright Aliaksei Levin (levlam@telegram.org), Arseny Smirnov (arseny30@gmail.com) 2014-2025
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#include "telegram-bot-api/WebhookConnectionPool.h"
+
+#include "td/utils/algorithm.h"
+#include "td/utils/logging.h"
+
+namespace telegram_bot_api {
+
+void WebhookConnectionRelay::set_owner(td::ActorShared<td::HttpOutboundConnection::Callback> owner) {
+  // the previous owner must not receive hangup
+  owner_.release();
+  owner_ = std::move(owner);
+}
+
+void WebhookConnectionRelay::handle(td::unique_ptr<td::HttpQuery> query) {
+  send_closure(owner_, &td::HttpOutboundConnection::Callback::handle, std::move(query));
+}
+
+void WebhookConnectionRelay::on_connection_error(td::Status error) {
+  send_closure(owner_, &td::HttpOutboundConnection::Callback::on_connection_error, std::move(error));
+}
+
+void WebhookConnectionRelay::hangup_shared() {
+  // the connection was closed; the owner will receive hangup after owner_ is destroyed
+  stop();
+}
+
+std::atomic<td::int64> WebhookConnectionPool::idle_connection_count_{0};
+
+WebhookConnection WebhookConnectionPool::take_connection(td::Slice target) {
+  auto it = target_connection_ids_.find(target.str());
+  if (it == target_connection_ids_.end()) {
+    return WebhookConnection();
+  }
+  CHECK(!it->second.empty());
+  auto id = it->second.back();
+  it->second.pop_back();
+  if (it->second.empty()) {
+    target_connection_ids_.erase(it);
+  }
+
+  auto *idle_connection = connections_.get(id);
+  CHECK(idle_connection != nullptr);
+  auto result = std::move(idle_connection->connection_);
+  connections_.erase(id);
+  idle_connection_count_.fetch_sub(1, std::memory_order_relaxed);
+  LOG(DEBUG) << "Reuse webhook connection to " << target;
+  return result;
+}
+
+void WebhookConnectionPool::put_connection(td::string target, WebhookConnection connection) {
+  CHECK(!connection.connection_.empty());
+  auto &connection_ids = target_connection_ids_[target];
+  if (connection_ids.size() >= MAX_IDLE_CONNECTIONS_PER_TARGET) {
+    // the connection is closed
+    return;
+  }
+
+  auto relay_id = connection.relay_id_;
+  auto id = connections_.create(IdleConnection{std::move(target), std::move(connection)});
+  connection_ids.push_back(id);
+  idle_connection_count_.fetch_add(1, std::memory_order_relaxed);
+  send_closure(relay_id, &WebhookConnectionRelay::set_owner,
+               td::ActorShared<td::HttpOutboundConnection::Callback>(actor_id(this), id));
+}
+
+void WebhookConnectionPool::drop_connection(td::uint64 id) {
+  auto *idle_connection = connections_.get(id);
+  if (idle_connection == nullptr) {
+    // the connection has already been reused or closed
+    return;
+  }
+
+  auto it = target_connection_ids_.find(idle_connection->target_);
+  CHECK(it != target_connection_ids_.end());
+  td::remove(it->second, id);
+  if (it->second.empty()) {
+    target_connection_ids_.erase(it);
+  }
+  connections_.erase(id);
+  idle_connection_count_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void WebhookConnectionPool::handle(td::unique_ptr<td::HttpQuery> query) {
+  // an idle connection must not receive responses
+  drop_connection(get_link_token());
+}
+
+void WebhookConnectionPool::on_connection_error(td::Status error) {
+  drop_connection(get_link_token());
+}
+
+void WebhookConnectionPool::hangup_shared() {
+  drop_connection(get_link_token());
+}
+
+void WebhookConnectionPool::tear_down() {
+  idle_connection_count_.fetch_sub(connections_.size(), std::memory_order_relaxed);
+}
+
+}  // namespace telegram_bot_api
@@ -0,0 +1,84 @@
+//
+// Copyright Aliaksei Levin (levlam@telegram.org), Arseny Smirnov (arseny30@gmail.com) 2014-2025
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#pragma once
+
+#include "td/net/HttpOutboundConnection.h"
+#include "td/net/HttpQuery.h"
+
+#include "td/actor/actor.h"
+
+#include "td/utils/common.h"
+#include "td/utils/Container.h"
+#include "td/utils/FlatHashMap.h"
+#include "td/utils/Slice.h"
+#include "td/utils/Status.h"
+
+#include <atomic>
+
+namespace telegram_bot_api {
+
+// Forwards events of an HttpOutboundConnection to its current owner, which can be changed
+class WebhookConnectionRelay final : public td::HttpOutboundConnection::Callback {
+ public:
+  explicit WebhookConnectionRelay(td::ActorShared<td::HttpOutboundConnection::Callback> owner)
+      : owner_(std::move(owner)) {
+  }
+
+  void set_owner(td::ActorShared<td::HttpOutboundConnection::Callback> owner);
+
+ private:
+  td::ActorShared<td::HttpOutboundConnection::Callback> owner_;
+
+  void handle(td::unique_ptr<td::HttpQuery> query) final;
+
+  void on_connection_error(td::Status error) final;
+
+  void hangup_shared() final;
+};
+
+struct WebhookConnection {
+  td::ActorOwn<td::HttpOutboundConnection> connection_;
+  td::ActorId<WebhookConnectionRelay> relay_id_;
+  td::int32 thread_index_ = 0;
+};
+
+// Keeps idle keep-alive webhook connections, which can be reused by any WebhookActor with the same target
+class WebhookConnectionPool final : public td::HttpOutboundConnection::Callback {
+ public:
+  // returns a connection with empty connection_ if there are no idle connections to the target
+  WebhookConnection take_connection(td::Slice target);
+
+  void put_connection(td::string target, WebhookConnection connection);
+
+  static td::int64 get_idle_connection_count() {
+    return idle_connection_count_;
+  }
+
+ private:
+  static constexpr std::size_t MAX_IDLE_CONNECTIONS_PER_TARGET = 100;
+
+  static std::atomic<td::int64> idle_connection_count_;
+
+  struct IdleConnection {
+    td::string target_;
+    WebhookConnection connection_;
+  };
+  td::Container<IdleConnection> connections_;
+  td::FlatHashMap<td::string, td::vector<td::uint64>> target_connection_ids_;
+
+  void drop_connection(td::uint64 id);
+
+  void handle(td::unique_ptr<td::HttpQuery> query) final;
+
+  void on_connection_error(td::Status error) final;
+
+  void hangup_shared() final;
+
+  void tear_down() final;
+};
+
+}  // namespace telegram_bot_api
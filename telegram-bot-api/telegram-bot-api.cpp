@@ -9,8 +9,10 @@
 #include "telegram-bot-api/HttpConnection.h"
 #include "telegram-bot-api/HttpServer.h"
 #include "telegram-bot-api/HttpStatConnection.h"
+#include "telegram-bot-api/Profiler.h"
 #include "telegram-bot-api/Stats.h"
 #include "telegram-bot-api/Watchdog.h"
+#include "telegram-bot-api/WebhookConnectionPool.h"
 
 #include "td/db/binlog/Binlog.h"
 
@@ -243,6 +245,23 @@ int main(int argc, char *argv[]) {
   options.add_checked_option('\0', "max-webhook-connections",
                              "default value of the maximum webhook connections per bot",
                              td::OptionParser::parse_integer(parameters->default_max_webhook_connections_));
+  options.add_checked_option('\0', "webhook-threads",
+                             PSLICE() << "number of threads for outgoing webhook connections (default is "
+                                      << parameters->webhook_thread_count_ << ")",
+                             td::OptionParser::parse_integer(parameters->webhook_thread_count_));
+  options.add_checked_option('\0', "webhook-compression-threshold",
+                             "minimum size of a webhook request body in bytes to send it gzip-compressed; webhook "
+                             "endpoints must support Content-Encoding \"gzip\" (default is 0, which disables "
+                             "compression)",
+                             td::OptionParser::parse_integer(parameters->webhook_compression_threshold_));
+  options.add_checked_option('\0', "update-compression-threshold",
+                             "minimum size of an update in bytes to store it compressed in the update queue (default "
+                             "is 0, which disables compression)",
+                             td::OptionParser::parse_integer(parameters->update_compression_threshold_));
+  options.add_checked_option('\0', "response-compression-threshold",
+                             "minimum size of a response body in bytes to send it gzip-compressed to clients, which "
+                             "accept Content-Encoding \"gzip\" (default is 0, which disables compression)",
+                             td::OptionParser::parse_integer(parameters->response_compression_threshold_));
   options.add_checked_option('\0', "http-ip-address",
                              "local IP address, HTTP connections to which will be accepted. By default, connections to "
                              "any local IPv4 address are accepted",
@@ -304,6 +323,32 @@ int main(int argc, char *argv[]) {
     }
     return td::Status::OK();
   });
+  options.add_check([&] {
+    if (parameters->webhook_thread_count_ <= 0 ||
+        parameters->webhook_thread_count_ > SharedData::MAX_SLOW_OUTGOING_HTTP_THREAD_COUNT) {
+      return td::Status::Error(PSLICE() << "Number of webhook threads must be between 1 and "
+                                        << SharedData::MAX_SLOW_OUTGOING_HTTP_THREAD_COUNT);
+    }
+    return td::Status::OK();
+  });
+  options.add_check([&] {
+    if (parameters->webhook_compression_threshold_ < 0) {
+      return td::Status::Error("Wrong webhook compression threshold specified");
+    }
+    return td::Status::OK();
+  });
+  options.add_check([&] {
+    if (parameters->update_compression_threshold_ < 0) {
+      return td::Status::Error("Wrong update compression threshold specified");
+    }
+    return td::Status::OK();
+  });
+  options.add_check([&] {
+    if (parameters->response_compression_threshold_ < 0) {
+      return td::Status::Error("Wrong response compression threshold specified");
+    }
+    return td::Status::OK();
+  });
   options.add_check([&] {
     if (default_verbosity_level < 0) {
       return td::Status::Error("Wrong verbosity level specified");
@@ -459,7 +504,8 @@ int main(int argc, char *argv[]) {
   //              << (td::GitInfo::is_dirty() ? "(dirty)" : "") << " started";
   LOG(WARNING) << "Bot API " << parameters->version_ << " server started";
 
-  td::ConcurrentScheduler sched(SharedData::get_thread_count() - 1, cpu_affinity);
+  auto thread_count = SharedData::get_thread_count(parameters->webhook_thread_count_);
+  td::ConcurrentScheduler sched(thread_count - 1, cpu_affinity);
 
   td::GetHostByNameActor::Options get_host_by_name_options;
   get_host_by_name_options.scheduler_id = SharedData::get_dns_resolver_scheduler_id();
@@ -467,6 +513,11 @@ int main(int argc, char *argv[]) {
       sched.create_actor_unsafe<td::GetHostByNameActor>(0, "GetHostByName", std::move(get_host_by_name_options))
           .release();
 
+  parameters->webhook_connection_pool_id_ =
+      sched.create_actor_unsafe<WebhookConnectionPool>(SharedData::get_client_scheduler_id(), "WebhookConnectionPool")
+          .release();
+
+  auto response_compression_threshold = parameters->response_compression_threshold_;
   auto client_manager = sched
                             .create_actor_unsafe<ClientManager>(SharedData::get_client_scheduler_id(), "ClientManager",
                                                                 std::move(parameters), token_range)
@@ -475,9 +526,9 @@ int main(int argc, char *argv[]) {
   sched
       .create_actor_unsafe<HttpServer>(
           SharedData::get_client_scheduler_id(), "HttpServer", http_ip_address, http_port,
-          [client_manager, shared_data] {
-            return td::ActorOwn<td::HttpInboundConnection::Callback>(
-                td::create_actor<HttpConnection>("HttpConnection", client_manager, shared_data));
+          [client_manager, shared_data, response_compression_threshold] {
+            return td::ActorOwn<td::HttpInboundConnection::Callback>(td::create_actor<HttpConnection>(
+                "HttpConnection", client_manager, shared_data, response_compression_threshold));
           })
       .release();
 
@@ -498,6 +549,14 @@ int main(int argc, char *argv[]) {
 
   sched.start();
 
+  {
+    auto guard = sched.get_main_guard();
+    for (td::int32 scheduler_id = 0; scheduler_id < thread_count; scheduler_id++) {
+      td::Scheduler::instance()->run_on_scheduler(
+          scheduler_id, [scheduler_id](td::Unit) { Profiler::set_thread_scheduler_id(scheduler_id); });
+    }
+  }
+
   double next_watchdog_kick_time = start_time;
   double next_cron_time = start_time;
   double last_dump_time = start_time - 1000.0;
@@ -557,8 +616,10 @@ int main(int argc, char *argv[]) {
       }
       next_cron_time += 1.0;
       auto guard = sched.get_main_guard();
-      td::Scheduler::instance()->run_on_scheduler(SharedData::get_statistics_thread_id(),
-                                                  [](td::Unit) { ServerCpuStat::update(td::Time::now()); });
+      td::Scheduler::instance()->run_on_scheduler(SharedData::get_statistics_thread_id(), [](td::Unit) {
+        ServerCpuStat::update(td::Time::now());
+        Profiler::flush();
+      });
     }
 
     if (now >= start_time + 600) {